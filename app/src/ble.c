@@ -13,17 +13,29 @@
 #include <zephyr/sys/printk.h>
 #include <zephyr/bluetooth/bluetooth.h>
 #include <zephyr/bluetooth/conn.h>
+#include <zephyr/bluetooth/att.h>
+#include <zephyr/bluetooth/gatt.h>
 #include <zephyr/bluetooth/audio/vcp.h>
 #include <zephyr/bluetooth/audio/aics.h>
 #include <zephyr/bluetooth/audio/vocs.h>
 
 #include "ble.h"
+#include "ble_cmd.h"
+#include "ble_bond.h"
+#include "ble_cache.h"
+#include "ble_link.h"
+#include "ble_match.h"
+#include "ble_reg.h"
+#include "ble_scan.h"
+#include "ble_set.h"
+#include "ble_subs.h"
 
 
 #define TGT_DEV_NAME        CONFIG_BT_TARGET_DEVICE_NAME
 #define RSHI_DEV_NAME       CONFIG_BT_TARGET_RSHI_DEVICE_NAME
 #define LSHI_DEV_NAME       CONFIG_BT_TARGET_LSHI_DEVICE_NAME
 
+/* In larger groups only the first device has a name, the others are set members */
 #if (BLE_CONN_CNT == 2)
 #define INIT_DEV_NAME { \
     RSHI_DEV_NAME, \
@@ -36,24 +48,376 @@
 #endif
 
 #define SCAN_TIMEOUT_SEC    10
+#define SCAN_SETTLE_MS      CONFIG_BLE_SCAN_SETTLE_MS
+
+/* Bring-up phases every connection goes through, independently of the others */
+typedef enum
+{
+    phase_idle = 0,
+    phase_connect,
+    phase_mtu,
+    phase_security,
+    phase_discover,
+    phase_ready,
+    phase_cnt,
+} bringup_phase_t;
+
+struct bringup {
+    bringup_phase_t phase;
+    uint32_t phase_start_ms;
+    uint32_t phase_ms[phase_cnt];
+};
 
 static struct bt_conn *ble_conn[BLE_CONN_CNT];
 static struct bt_vcp_vol_ctlr *vcp_vol_ctlr[BLE_CONN_CNT];
 static struct bt_vcp_included vcp_included[BLE_CONN_CNT];
 
+/* Instance layout known for each connection, from the discovery cache or from discovery */
+static uint8_t vocs_cnt[BLE_CONN_CNT];
+static uint8_t aics_cnt[BLE_CONN_CNT];
+
 static bool ble_dev_found[BLE_CONN_CNT];
 static bool ble_dev_connected[BLE_CONN_CNT];
 static bt_addr_le_t pd_addr[BLE_CONN_CNT];
 const char *dev_name[BLE_CONN_CNT] = INIT_DEV_NAME;
 static bool scan_started;
 
+static bool connect_pending[BLE_CONN_CNT];
+static struct bringup bringup[BLE_CONN_CNT];
+static struct bt_gatt_exchange_params mtu_params[BLE_CONN_CNT];
+static const char *const phase_name[phase_cnt] = {
+    "idle", "connect", "mtu", "security", "discover", "ready"
+};
+
+static bool auto_conn_enabled;
+static bool auto_conn_running;
+static bool auto_conn_suspended[BLE_CONN_CNT];
+static uint32_t auto_conn_start_ms;
+
+/* Slots the user wants connected, searched for in the background while absent */
+static bool member_wanted[BLE_CONN_CNT];
+static bool bg_scan_running;
+/* Bonded addresses resolved when the background scan starts, compared on every report */
+static bt_addr_le_t bg_scan_addr[BLE_CONN_CNT];
+static uint32_t bg_scan_bonded;
+
+/* Slots that can be filled by members of the coordinated set */
+static uint32_t set_slots;
+
 static struct k_work_delayable scan_timeout_work;
+static struct k_work_delayable scan_settle_work;
 
 static scan_status_callback_t *user_scan_status_cb = NULL;
 static conn_status_callback_t *user_conn_status_cb = NULL;
 static vcp_status_callback_t *user_vcp_status_cb = NULL;
 
 
+static int conn_to_idx(const struct bt_conn *conn)
+{
+    return ble_reg_conn_idx(conn);
+}
+
+/* Slots scanned for by name, the others are only found as members of a coordinated set */
+static bool slot_named(uint8_t conn_idx)
+{
+    return (dev_name[conn_idx] != NULL);
+}
+
+static bool conn_initiating(void)
+{
+    for (uint8_t i = 0; i < BLE_CONN_CNT; i++) {
+        if ((ble_conn[i] != NULL) && !ble_dev_connected[i]) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+static void auto_connect_pause(void)
+{
+    if (auto_conn_running) {
+        bt_conn_create_auto_stop();
+        auto_conn_running = false;
+    }
+}
+
+static bool auto_connect_covers(uint8_t conn_idx)
+{
+    bt_addr_le_t addr;
+
+    return auto_conn_enabled && !auto_conn_suspended[conn_idx] && ble_bond_get(conn_idx, &addr);
+}
+
+static uint32_t members_missing(void)
+{
+    uint32_t missing = 0;
+
+    for (uint8_t i = 0; i < BLE_CONN_CNT; i++) {
+        if (member_wanted[i] && (ble_conn[i] == NULL)) {
+            missing |= BIT(i);
+        }
+    }
+
+    return missing;
+}
+
+static void bg_scan_stop(void)
+{
+    if (!bg_scan_running) {
+        return;
+    }
+
+    int err = bt_le_scan_stop();
+    if (err) {
+        printk("Failed to stop background scan: %d\n", err);
+    }
+
+    bg_scan_running = false;
+}
+
+static void auto_connect_resume(void);
+
+static void bg_scan_recv_cb(const bt_addr_le_t *addr, int8_t rssi, uint8_t adv_type,
+                            struct net_buf_simple *ad)
+{
+    ble_match_result_t match;
+    uint32_t missing = members_missing();
+    int conn_idx = -1;
+
+    if ((addr == NULL) || !bg_scan_running) {
+        return;
+    }
+
+    /* Bonded peers are recognized by their resolved identity address */
+    for (uint8_t i = 0; i < BLE_CONN_CNT; i++) {
+        if ((missing & bg_scan_bonded & BIT(i)) && bt_addr_le_eq(&bg_scan_addr[i], addr)) {
+            conn_idx = i;
+            break;
+        }
+    }
+
+    if ((conn_idx < 0) && ble_match_report(ad, missing, &match)) {
+        uint32_t slots = match.targets;
+
+        /* A set member takes the first free set slot */
+        if (!slots && match.set_member) {
+            slots = missing & set_slots;
+        }
+
+        conn_idx = find_lsb_set(slots) - 1;
+    }
+
+    if (conn_idx < 0) {
+        return;
+    }
+
+    /* Members already connected keep advertising their RSI */
+    struct bt_conn *conn = bt_conn_lookup_addr_le(BT_ID_DEFAULT, addr);
+    if (conn != NULL) {
+        bt_conn_unref(conn);
+        return;
+    }
+
+    printk("Connection %d: missing device is back, reconnecting\n", conn_idx);
+
+    bg_scan_stop();
+    bt_addr_le_copy(&pd_addr[conn_idx], addr);
+    ble_dev_found[conn_idx] = true;
+
+    if (ble_connect(conn_idx) < 0) {
+        auto_connect_resume();
+    }
+}
+
+/*
+ * Run a low duty cycle scan while a wanted device is absent and the bonded
+ * auto connection does not cover it. The scan ends as soon as one of them is
+ * seen, so that it can be connected.
+ */
+static bool bg_scan_resume(void)
+{
+    const struct bt_le_scan_param param = {
+        .type       = BT_LE_SCAN_TYPE_ACTIVE,
+        .options    = BT_LE_SCAN_OPT_NONE,
+        .interval   = CONFIG_BLE_BG_SCAN_INTERVAL,
+        .window     = CONFIG_BLE_BG_SCAN_WINDOW,
+        .timeout    = 0,
+    };
+    uint32_t missing = members_missing();
+    bool needed = false;
+
+    for (uint8_t i = 0; i < BLE_CONN_CNT; i++) {
+        if ((missing & BIT(i)) && !auto_connect_covers(i)) {
+            needed = true;
+        }
+    }
+
+    if (!IS_ENABLED(CONFIG_BLE_BG_SCAN) || !needed) {
+        bg_scan_stop();
+        return false;
+    }
+
+    if (bg_scan_running) {
+        return true;
+    }
+
+    auto_connect_pause();
+
+    /* All bonded slots, a slot that goes missing later is found without a restart */
+    bg_scan_bonded = 0;
+    for (uint8_t i = 0; i < BLE_CONN_CNT; i++) {
+        if (ble_bond_get(i, &bg_scan_addr[i])) {
+            bg_scan_bonded |= BIT(i);
+        }
+    }
+
+    int err = ble_match_build(dev_name, BLE_CONN_CNT);
+    if (!err) {
+        err = bt_le_scan_start(&param, bg_scan_recv_cb);
+    }
+
+    if (err) {
+        printk("Background scan failed to start (err %d)\n", err);
+        return false;
+    }
+
+    bg_scan_running = true;
+    printk("Background scan for missing devices started.\n");
+
+    return true;
+}
+
+/*
+ * (Re)arm the controller to connect to any bonded peer whose slot is not
+ * connected. The filter accept list can only be changed while not initiating,
+ * so a running auto connection is stopped first.
+ */
+static void auto_connect_resume(void)
+{
+    bt_addr_le_t addr;
+    int cnt = 0;
+
+    if (scan_started) {
+        return;
+    }
+
+    /* Only one connection can be initiated at a time */
+    if (conn_initiating()) {
+        return;
+    }
+
+    /* The background scan also finds bonded peers, it replaces the auto connection */
+    if (bg_scan_resume() || !auto_conn_enabled) {
+        return;
+    }
+
+    auto_connect_pause();
+    bt_le_filter_accept_list_clear();
+
+    for (uint8_t i = 0; i < BLE_CONN_CNT; i++) {
+        if ((ble_conn[i] != NULL) || auto_conn_suspended[i] || !ble_bond_get(i, &addr)) {
+            continue;
+        }
+
+        int err = bt_le_filter_accept_list_add(&addr);
+        if (err) {
+            printk("Connection %d: accept list add failed (err %d)\n", i, err);
+            continue;
+        }
+
+        cnt++;
+    }
+
+    if (cnt == 0) {
+        return;
+    }
+
+    int err = bt_conn_le_create_auto(BT_CONN_LE_CREATE_CONN_AUTO, BLE_LINK_FAST_PARAM);
+    if (err) {
+        printk("Auto connect failed to start (err %d)\n", err);
+        return;
+    }
+
+    auto_conn_running = true;
+    auto_conn_start_ms = k_uptime_get_32();
+    printk("Auto connecting to %d bonded device(s)...\n", cnt);
+}
+
+int ble_auto_connect_start(void)
+{
+    bt_addr_le_t addr;
+    int cnt = 0;
+
+    for (uint8_t i = 0; i < BLE_CONN_CNT; i++) {
+        auto_conn_suspended[i] = false;
+
+        if (ble_bond_get(i, &addr)) {
+            member_wanted[i] = true;
+            cnt++;
+        }
+    }
+
+    auto_conn_enabled = (cnt > 0);
+    auto_connect_resume();
+
+    return cnt;
+}
+
+#if defined(CONFIG_BLE_GROUP_CSIP)
+static void set_discovered(uint8_t conn_idx, int err, uint8_t set_size, uint8_t rank)
+{
+    if (err || (set_size < 2)) {
+        return;
+    }
+
+    /* The slots beyond the named ones are filled by the other set members */
+    set_slots = BIT_MASK(MIN(set_size, BLE_CONN_CNT));
+    ble_match_set_sirk(ble_set_sirk(), set_slots);
+
+    if (member_wanted[conn_idx]) {
+        for (uint8_t i = 0; i < BLE_CONN_CNT; i++) {
+            if (set_slots & BIT(i)) {
+                member_wanted[i] = true;
+            }
+        }
+    }
+
+    auto_connect_resume();
+}
+#endif
+
+static void scan_stats_print(void)
+{
+    ble_scan_stats_t stats;
+
+    ble_scan_stats_get(&stats);
+    printk("Scan: %u reports from %u advertisers, %u cached, %u evicted\n",
+           stats.reports, stats.entries, stats.cached, stats.evicted);
+}
+
+/* Pick the strongest advertiser of every target that is not connected */
+static void scan_select_best(void)
+{
+    ble_scan_entry_t entry;
+
+    for (int i = 0; i < BLE_CONN_CNT; i++) {
+        if (!ble_dev_found[i] || ble_dev_connected[i]) {
+            continue;
+        }
+
+        int cnt = ble_scan_table_best(i, &entry);
+        if (cnt > 0) {
+            char le_addr[BT_ADDR_LE_STR_LEN];
+
+            bt_addr_le_copy(&pd_addr[i], &entry.addr);
+            bt_addr_le_to_str(&pd_addr[i], le_addr, sizeof(le_addr));
+            printk("Connection %d: selected %s (%d dBm) of %d candidate(s)\n",
+                   i, le_addr, entry.rssi, cnt);
+        }
+    }
+}
+
 int ble_stop_scan(void)
 {
     int err = bt_le_scan_stop();
@@ -63,64 +427,73 @@ int ble_stop_scan(void)
     }
 
     k_work_cancel_delayable(&scan_timeout_work);
+    k_work_cancel_delayable(&scan_settle_work);
 
     scan_started = false;
     printk("Scan stopped.\n");
+    scan_stats_print();
+    scan_select_best();
+
+    auto_connect_resume();
 
     return 0;
 }
 
-static bool scan_data_cb(struct bt_data *data, void *user_data)
+static void scan_recv_cb(const bt_addr_le_t *addr, int8_t rssi, uint8_t adv_type,
+                         struct net_buf_simple *ad)
 {
-    char *name = user_data;
-    uint8_t len;
+    ble_scan_entry_t entry;
+    uint32_t targets = 0;
+    uint32_t matched;
 
-    switch (data->type) {
-    case BT_DATA_NAME_SHORTENED:
-    case BT_DATA_NAME_COMPLETE:
-        len = MIN(data->data_len, MAX_DEVICE_NAME_LEN - 1);
-        memcpy(name, data->data, len);
-        name[len] = '\0';
-        return false;
-    default:
-        return true;
+    if (addr == NULL) {
+        return;
     }
-}
 
-static void scan_recv_cb(const bt_addr_le_t *addr, int8_t rssi, uint8_t adv_type,
-                         struct net_buf_simple *ad)
-{
-    char name[MAX_DEVICE_NAME_LEN];
+    for (int i = 0; i < BLE_CONN_CNT; i++) {
+        if (!ble_dev_connected[i]) {
+            targets |= BIT(i);
+        }
+    }
 
-    bt_data_parse(ad, scan_data_cb, name);
+    matched = ble_scan_table_update(addr, rssi, adv_type, ad, targets);
+    if (!matched) {
+        return;
+    }
 
     for (int i = 0; i < BLE_CONN_CNT; i++) {
-        if (!ble_dev_found[i] && !strcmp(dev_name[i], name)) {
+        if ((matched & BIT(i)) && !ble_dev_found[i]) {
             char le_addr[BT_ADDR_LE_STR_LEN];
 
-            if (addr == NULL) {
-                return;
-            }
-
             ble_dev_found[i] = true;
             memcpy(&pd_addr[i], addr, sizeof(pd_addr[i]));
+            ble_scan_table_best(i, &entry);
 
             bt_addr_le_to_str(&pd_addr[i], le_addr, sizeof(le_addr));
-            printk("Found device with name %s and address %s\n", name, le_addr);
+            printk("Found device with name %s and address %s\n", entry.name, le_addr);
 
             if (user_scan_status_cb) {
-                user_scan_status_cb(scan_available, name);
+                user_scan_status_cb(scan_available, entry.name);
             }
         }
     }
 
+    /* Set members are searched for once a named device told its set */
     for (int i = 0; i < BLE_CONN_CNT; i++) {
-        if(!ble_dev_found[i] && !ble_dev_connected[i]) {
+        if (slot_named(i) && !ble_dev_found[i] && !ble_dev_connected[i]) {
             return;
         }
     }
 
-    ble_stop_scan();
+    /* Keep scanning a little longer, a stronger device of the same name may still show up */
+    k_work_schedule(&scan_settle_work, K_MSEC(SCAN_SETTLE_MS));
+}
+
+static void scan_settle_cb(struct k_work *work)
+{
+    if (ble_stop_scan()) {
+        return;
+    }
 
     if (user_scan_status_cb) {
         user_scan_status_cb(scan_done, NULL);
@@ -147,6 +520,16 @@ int ble_start_scan(void)
         ble_dev_found[i] = false;
     }
 
+    err = ble_match_build(dev_name, BLE_CONN_CNT);
+    if (err) {
+        printk("Building the scan matcher failed (err %d)\n", err);
+        return -1;
+    }
+
+    ble_scan_table_reset();
+    auto_connect_pause();
+    bg_scan_stop();
+
     err = bt_le_scan_start(&param, scan_recv_cb);
     if (err) {
         printk("Starting scanning failed (err %d)\n", err);
@@ -163,8 +546,14 @@ int ble_start_scan(void)
 
 static void scan_timeout_cb(struct k_work *work)
 {
+    bt_le_scan_stop();
+    k_work_cancel_delayable(&scan_settle_work);
     scan_started = false;
     printk("Scan timeout!\n");
+    scan_stats_print();
+    scan_select_best();
+
+    auto_connect_resume();
 
     if (user_scan_status_cb) {
         user_scan_status_cb(scan_timeout ,NULL);
@@ -183,24 +572,185 @@ int ble_start_scan_force(void)
     return ble_start_scan();
 }
 
+static void bringup_enter(uint8_t conn_idx, bringup_phase_t phase)
+{
+    struct bringup *bu = &bringup[conn_idx];
+    uint32_t now = k_uptime_get_32();
+
+    if ((bu->phase != phase_idle) && (bu->phase != phase_ready)) {
+        bu->phase_ms[bu->phase] = now - bu->phase_start_ms;
+    }
+
+    if (phase == phase_connect) {
+        memset(bu->phase_ms, 0, sizeof(bu->phase_ms));
+        ble_cmd_conn_hold(conn_idx, true);
+    }
+
+    bu->phase = phase;
+    bu->phase_start_ms = now;
+
+    if (phase == phase_ready) {
+        uint32_t total_ms = 0;
+
+        for (int i = phase_connect; i < phase_ready; i++) {
+            total_ms += bu->phase_ms[i];
+        }
+
+        printk("Connection %d: ready in %u ms "
+               "(connect %u, mtu %u, security %u, discover %u)\n",
+               conn_idx, total_ms, bu->phase_ms[phase_connect], bu->phase_ms[phase_mtu],
+               bu->phase_ms[phase_security], bu->phase_ms[phase_discover]);
+        printk("Connection %d: %d ATT bearer(s)\n", conn_idx, ble_att_bearer_count(conn_idx));
+
+        ble_cmd_conn_hold(conn_idx, false);
+        ble_link_ready(conn_idx);
+        ble_subs_ready(conn_idx, ble_conn[conn_idx], vocs_cnt[conn_idx], aics_cnt[conn_idx]);
+
+#if defined(CONFIG_BLE_GROUP_CSIP)
+        ble_set_discover(conn_idx, ble_conn[conn_idx]);
+#endif
+    }
+}
+
+static void bringup_fail(uint8_t conn_idx, int err)
+{
+    printk("Connection %d: bring-up failed in phase %s (err %d)\n",
+           conn_idx, phase_name[bringup[conn_idx].phase], err);
+
+    bringup[conn_idx].phase = phase_idle;
+    ble_cmd_conn_hold(conn_idx, false);
+}
+
+static void report_discover(uint8_t conn_idx, int err, bool cached)
+{
+    if (user_vcp_status_cb) {
+        vcp_discover_t discover;
+        discover.conn_idx = conn_idx;
+        discover.err = err;
+        discover.vocs_count = vocs_cnt[conn_idx];
+        discover.aics_count = aics_cnt[conn_idx];
+        discover.cached = cached;
+
+        user_vcp_status_cb(vcp_discover, &discover);
+    }
+}
+
+/*
+ * The volume controller cannot be seeded with cached handles, so discovery
+ * always runs. When the layout of the bonded peer is cached it is reported
+ * right away, letting the UI come up while discovery completes; commands are
+ * held until then.
+ */
+static void bringup_discover(uint8_t conn_idx)
+{
+    ble_cache_layout_t layout;
+
+    if (ble_cache_get(conn_idx, &layout)) {
+        printk("Connection %d: discovery cache hit\n", conn_idx);
+        vocs_cnt[conn_idx] = layout.vocs_count;
+        aics_cnt[conn_idx] = layout.aics_count;
+        report_discover(conn_idx, 0, true);
+    }
+
+    /* Failures are reported to the user through the VCP discover status */
+    ble_vcp_discover(conn_idx);
+}
+
+static void bringup_security(uint8_t conn_idx)
+{
+    bringup_enter(conn_idx, phase_security);
+
+    /* Bonded peers may already be encrypted, e.g. after a security request */
+    if (bt_conn_get_security(ble_conn[conn_idx]) >= BT_SECURITY_L2) {
+        bringup_discover(conn_idx);
+        return;
+    }
+
+    int err = bt_conn_set_security(ble_conn[conn_idx], BT_SECURITY_L2);
+    if (err) {
+        printk("Connection %d: failed to set security (err %d)\n", conn_idx, err);
+        bringup_discover(conn_idx);
+    }
+}
+
+static void mtu_exchange_cb(struct bt_conn *conn, uint8_t err,
+                            struct bt_gatt_exchange_params *params)
+{
+    int conn_idx = conn_to_idx(conn);
+
+    if ((conn_idx == -1) || (bringup[conn_idx].phase != phase_mtu)) {
+        return;
+    }
+
+    if (err) {
+        printk("Connection %d: MTU exchange failed (err %u)\n", conn_idx, err);
+    } else {
+        printk("Connection %d: MTU %u\n", conn_idx, bt_gatt_get_mtu(conn));
+    }
+
+    bringup_security(conn_idx);
+}
+
+static void bringup_mtu(uint8_t conn_idx)
+{
+    bringup_enter(conn_idx, phase_mtu);
+
+    mtu_params[conn_idx].func = mtu_exchange_cb;
+
+    int err = bt_gatt_exchange_mtu(ble_conn[conn_idx], &mtu_params[conn_idx]);
+    if (err) {
+        /* -EALREADY when the host has already exchanged the MTU on its own */
+        printk("Connection %d: MTU exchange skipped (err %d)\n", conn_idx, err);
+        bringup_security(conn_idx);
+    }
+}
+
 static int connect_to_device(uint8_t conn_idx)
 {
     char addr_str[BT_ADDR_LE_STR_LEN];
 
-    bt_addr_le_to_str(&pd_addr[conn_idx], addr_str, sizeof(addr_str));
-    printk("Connecting to connection %d (name: %s, addr: %s)...\n",
-           conn_idx, dev_name[conn_idx], addr_str);
+    bt_addr_le_to_str(&pd_addr[conn_idx], addr_str, sizeof(addr_str));
+    printk("Connecting to connection %d (name: %s, addr: %s)...\n",
+           conn_idx, (dev_name[conn_idx] != NULL) ? dev_name[conn_idx] : "set member", addr_str);
+
+    bringup_enter(conn_idx, phase_connect);
+    bg_scan_stop();
+
+    int err = bt_conn_le_create(&pd_addr[conn_idx],
+                                BT_CONN_LE_CREATE_CONN,
+                                BLE_LINK_FAST_PARAM,
+                                &ble_conn[conn_idx]);
+    if (err) {
+        printk("Connection failed (err %d)\n", err);
+        bringup_fail(conn_idx, err);
+        return -1;
+    }
+
+    ble_reg_conn_add(ble_conn[conn_idx], conn_idx);
+
+    return 0;
+}
+
+/*
+ * Only one connection can be initiated at a time. Connections requested
+ * meanwhile are created as soon as the initiator is free, while the
+ * connections already established carry on with their own bring-up.
+ */
+static void connect_next_pending(void)
+{
+    for (uint8_t i = 0; i < BLE_CONN_CNT; i++) {
+        if (!connect_pending[i]) {
+            continue;
+        }
+
+        connect_pending[i] = false;
 
-    int err = bt_conn_le_create(&pd_addr[conn_idx],
-                                BT_CONN_LE_CREATE_CONN,
-                                BT_LE_CONN_PARAM_DEFAULT,
-                                &ble_conn[conn_idx]);
-    if (err) {
-        printk("Connection failed (err %d)\n", err);
-        return -1;
+        if (!ble_dev_connected[i] && (ble_conn[i] == NULL) && !connect_to_device(i)) {
+            return;
+        }
     }
 
-    return 0;
+    auto_connect_resume();
 }
 
 int ble_connect(uint8_t conn_idx)
@@ -217,6 +767,37 @@ int ble_connect(uint8_t conn_idx)
         }
     }
 
+    /* A bonded peer can be connected by its identity address without scanning */
+    if (!ble_dev_found[conn_idx] && ble_bond_get(conn_idx, &pd_addr[conn_idx])) {
+        ble_dev_found[conn_idx] = true;
+    }
+
+    /* Filled by the background scan once the set of a connected member is known */
+    if (!ble_dev_found[conn_idx] && !slot_named(conn_idx)) {
+        printk("Connection %d: waiting for set discovery.\n", conn_idx);
+        return 0;
+    }
+
+    if (!ble_dev_found[conn_idx]) {
+        printk("Connection %d: device not found yet!\n", conn_idx);
+        return -1;
+    }
+
+    auto_conn_suspended[conn_idx] = false;
+    member_wanted[conn_idx] = true;
+
+    if (connect_pending[conn_idx] || (ble_conn[conn_idx] != NULL)) {
+        return 0;
+    }
+
+    if (conn_initiating()) {
+        connect_pending[conn_idx] = true;
+        printk("Connection %d: queued.\n", conn_idx);
+        return 0;
+    }
+
+    auto_connect_pause();
+
     return connect_to_device(conn_idx);
 }
 
@@ -227,6 +808,10 @@ int ble_disconnect(uint8_t conn_idx)
         return 1;
     }
 
+    /* Do not bring a peer the user disconnected straight back */
+    auto_conn_suspended[conn_idx] = true;
+    member_wanted[conn_idx] = false;
+
     int err = bt_conn_disconnect(ble_conn[conn_idx], BT_HCI_ERR_REMOTE_USER_TERM_CONN);
     if (err) {
         printk("Connection %d: failed to disconnect (err %d)\n", conn_idx, err);
@@ -236,18 +821,30 @@ int ble_disconnect(uint8_t conn_idx)
     return 0;
 }
 
+/* The stack objects are registered when discovered, every lookup is a single hash probe */
+static int vol_ctlr_conn_idx(struct bt_vcp_vol_ctlr *vol_ctlr)
+{
+    uint8_t conn_idx, inst_idx;
+
+    return ble_reg_obj_find(vol_ctlr, &conn_idx, &inst_idx) ? conn_idx : -1;
+}
+
+static bool vocs_inst_idx(struct bt_vocs *inst, uint8_t *conn_idx, uint8_t *inst_idx)
+{
+    return ble_reg_obj_find(inst, conn_idx, inst_idx);
+}
+
+static bool aics_inst_idx(struct bt_aics *inst, uint8_t *conn_idx, uint8_t *inst_idx)
+{
+    return ble_reg_obj_find(inst, conn_idx, inst_idx);
+}
+
 static void vcp_discover_cb(struct bt_vcp_vol_ctlr *vol_ctlr, int err, uint8_t vocs_count,
                             uint8_t aics_count)
 {
-    int conn_idx = -1;
+    int conn_idx = vol_ctlr_conn_idx(vol_ctlr);
     int disc_err = 0;
 
-    for (int i = 0; i < BLE_CONN_CNT; i++) {
-        if (vol_ctlr == vcp_vol_ctlr[i]) {
-            conn_idx = i;
-        }
-    }
-
     if (conn_idx == -1) {
         return;
     }
@@ -261,29 +858,39 @@ static void vcp_discover_cb(struct bt_vcp_vol_ctlr *vol_ctlr, int err, uint8_t v
             disc_err = -2;
             printk("Connecion %d: could not get VCP context!\n", conn_idx);
         }
+
+        for (uint8_t i = 0; !res && (i < vcp_included[conn_idx].vocs_cnt); i++) {
+            ble_reg_obj_add(vcp_included[conn_idx].vocs[i], conn_idx, i);
+        }
+
+        for (uint8_t i = 0; !res && (i < vcp_included[conn_idx].aics_cnt); i++) {
+            ble_reg_obj_add(vcp_included[conn_idx].aics[i], conn_idx, i);
+        }
     }
 
-    if (user_vcp_status_cb) {
-        vcp_discover_t discover;
-        discover.conn_idx = conn_idx;
-        discover.err = disc_err;
-        discover.vocs_count = vcp_included[conn_idx].vocs_cnt;
-        discover.aics_count = vcp_included[conn_idx].aics_cnt;
+    /* The volume controller subscribes to all characteristics as part of discovery */
+    if (disc_err) {
+        bringup_fail(conn_idx, disc_err);
+    } else {
+        const ble_cache_layout_t layout = {
+            .vocs_count = vcp_included[conn_idx].vocs_cnt,
+            .aics_count = vcp_included[conn_idx].aics_cnt,
+        };
 
-        user_vcp_status_cb(vcp_discover, &discover);
+        vocs_cnt[conn_idx] = layout.vocs_count;
+        aics_cnt[conn_idx] = layout.aics_count;
+        ble_cache_update(conn_idx, &layout);
+
+        bringup_enter(conn_idx, phase_ready);
     }
+
+    report_discover(conn_idx, disc_err, false);
 }
 
 static void vcp_volume_state_cb(struct bt_vcp_vol_ctlr *vol_ctlr, int err, uint8_t volume,
                                 uint8_t mute)
 {
-    int conn_idx = -1;
-
-    for (int i = 0; i < BLE_CONN_CNT; i++) {
-        if (vol_ctlr == vcp_vol_ctlr[i]) {
-            conn_idx = i;
-        }
-    }
+    int conn_idx = vol_ctlr_conn_idx(vol_ctlr);
 
     if (conn_idx == -1) {
         return;
@@ -302,56 +909,138 @@ static void vcp_volume_state_cb(struct bt_vcp_vol_ctlr *vol_ctlr, int err, uint8
 
 static void vcp_vocs_state_cb(struct bt_vocs *inst, int err, int16_t offset)
 {
-    for (int i = 0; i < BLE_CONN_CNT; i++) {
-        for (int j = 0; j < vcp_included[i].vocs_cnt; ++j) {
-            if (vcp_included[i].vocs[j] == inst) {
-                if (user_vcp_status_cb) {
-                    vcp_vocs_state_t state;
-                    state.conn_idx = i;
-                    state.inst_idx = j;
-                    state.err = err;
-                    state.offset = offset;
-
-                    user_vcp_status_cb(vcp_vocs_state, &state);
-                }
-            }
-        }
+    uint8_t conn_idx, inst_idx;
+
+    if (!vocs_inst_idx(inst, &conn_idx, &inst_idx)) {
+        return;
+    }
+
+    /* Notifications and read responses both end up here */
+    ble_cmd_complete(conn_idx, ble_cmd_vocs_read, inst_idx, err);
+
+    if (user_vcp_status_cb) {
+        vcp_vocs_state_t state;
+        state.conn_idx = conn_idx;
+        state.inst_idx = inst_idx;
+        state.err = err;
+        state.offset = offset;
+
+        user_vcp_status_cb(vcp_vocs_state, &state);
     }
 }
 
 static void vcp_aics_state_cb(struct bt_aics *inst, int err, int8_t gain, uint8_t mute,
                               uint8_t mode)
 {
-    for (int i = 0; i < BLE_CONN_CNT; i++) {
-        for (uint8_t j = 0; j < vcp_included[i].aics_cnt; ++j) {
-            if (vcp_included[i].aics[j] == inst) {
-                if (user_vcp_status_cb) {
-                    vcp_aics_state_t state;
-                    state.conn_idx = i;
-                    state.inst_idx = j;
-                    state.err = err;
-                    state.gain = gain;
-                    state.mute = mute;
-                    state.mode = mode;
-
-                    user_vcp_status_cb(vcp_aics_state, &state);
-                }
-            }
-        }
+    uint8_t conn_idx, inst_idx;
+
+    if (!aics_inst_idx(inst, &conn_idx, &inst_idx)) {
+        return;
+    }
+
+    ble_cmd_complete(conn_idx, ble_cmd_aics_read, inst_idx, err);
+
+    if (user_vcp_status_cb) {
+        vcp_aics_state_t state;
+        state.conn_idx = conn_idx;
+        state.inst_idx = inst_idx;
+        state.err = err;
+        state.gain = gain;
+        state.mute = mute;
+        state.mode = mode;
+
+        user_vcp_status_cb(vcp_aics_state, &state);
+    }
+}
+
+static void vcp_vol_write_cb(struct bt_vcp_vol_ctlr *vol_ctlr, int err)
+{
+    int conn_idx = vol_ctlr_conn_idx(vol_ctlr);
+
+    if (conn_idx != -1) {
+        ble_cmd_complete(conn_idx, ble_cmd_vcs_volume, 0, err);
+    }
+}
+
+static void vcp_mute_write_cb(struct bt_vcp_vol_ctlr *vol_ctlr, int err)
+{
+    int conn_idx = vol_ctlr_conn_idx(vol_ctlr);
+
+    if (conn_idx != -1) {
+        ble_cmd_complete(conn_idx, ble_cmd_vcs_mute, 0, err);
+    }
+}
+
+static void vcp_vol_step_cb(struct bt_vcp_vol_ctlr *vol_ctlr, int err)
+{
+    int conn_idx = vol_ctlr_conn_idx(vol_ctlr);
+
+    if (conn_idx != -1) {
+        ble_cmd_complete(conn_idx, ble_cmd_vcs_step, 0, err);
+    }
+}
+
+static void vcp_vocs_set_offset_cb(struct bt_vocs *inst, int err)
+{
+    uint8_t conn_idx, inst_idx;
+
+    if (vocs_inst_idx(inst, &conn_idx, &inst_idx)) {
+        ble_cmd_complete(conn_idx, ble_cmd_vocs_offset, inst_idx, err);
+    }
+}
+
+static void vcp_aics_gain_write_cb(struct bt_aics *inst, int err)
+{
+    uint8_t conn_idx, inst_idx;
+
+    if (aics_inst_idx(inst, &conn_idx, &inst_idx)) {
+        ble_cmd_complete(conn_idx, ble_cmd_aics_gain, inst_idx, err);
+    }
+}
+
+static void vcp_aics_mute_write_cb(struct bt_aics *inst, int err)
+{
+    uint8_t conn_idx, inst_idx;
+
+    if (aics_inst_idx(inst, &conn_idx, &inst_idx)) {
+        ble_cmd_complete(conn_idx, ble_cmd_aics_mute, inst_idx, err);
     }
 }
 
 static struct bt_vcp_vol_ctlr_cb vcp_cbs = {
     .discover = vcp_discover_cb,
     .state = vcp_volume_state_cb,
+    .vol_set = vcp_vol_write_cb,
+    .vol_up_unmute = vcp_vol_step_cb,
+    .vol_down = vcp_vol_step_cb,
+    .mute = vcp_mute_write_cb,
+    .unmute = vcp_mute_write_cb,
     .vocs_cb = {
         .state = vcp_vocs_state_cb,
+        .set_offset = vcp_vocs_set_offset_cb,
     },
     .aics_cb = {
         .state = vcp_aics_state_cb,
+        .set_gain = vcp_aics_gain_write_cb,
+        .mute = vcp_aics_mute_write_cb,
+        .unmute = vcp_aics_mute_write_cb,
     }
 };
 
+int ble_att_bearer_count(uint8_t conn_idx)
+{
+    if ((conn_idx >= BLE_CONN_CNT) || (ble_conn[conn_idx] == NULL)) {
+        return 0;
+    }
+
+#if defined(CONFIG_BT_EATT)
+    /* Unenhanced bearer plus the enhanced ones set up after encryption */
+    return 1 + bt_eatt_count(ble_conn[conn_idx]);
+#else
+    return 1;
+#endif
+}
+
 int ble_vcp_discover(uint8_t conn_idx)
 {
     if (ble_conn[conn_idx] == NULL) {
@@ -359,135 +1048,249 @@ int ble_vcp_discover(uint8_t conn_idx)
         return -2;
     }
 
+    ble_link_activity(conn_idx);
+    bringup_enter(conn_idx, phase_discover);
+
     int err = bt_vcp_vol_ctlr_discover(ble_conn[conn_idx], &vcp_vol_ctlr[conn_idx]);
     if (err != 0) {
         printk("Connection %d: VCP discovering failed: %d\n", conn_idx, err);
+        bringup_fail(conn_idx, err);
         return -3;
     }
 
+    /* Registered before the discover callback, which looks it up */
+    ble_reg_obj_add(vcp_vol_ctlr[conn_idx], conn_idx, 0);
+
     return 0;
 }
 
-int ble_update_volume(uint8_t conn_idx, uint8_t volume)
+static int vcp_cmd_write(const ble_cmd_t *cmd)
 {
-    int result;
+    uint8_t conn_idx = cmd->conn_idx;
+    uint8_t inst_idx = cmd->inst_idx;
 
-    if (ble_conn[conn_idx] == NULL) {
-        printk("Connection %d: not connected!\n", conn_idx);
-        return -2;
+    if ((ble_conn[conn_idx] == NULL) || (vcp_vol_ctlr[conn_idx] == NULL)) {
+        return -ENOTCONN;
+    }
+
+    switch (cmd->type) {
+    case ble_cmd_vcs_volume:
+        return bt_vcp_vol_ctlr_set_vol(vcp_vol_ctlr[conn_idx], cmd->value);
+    case ble_cmd_vcs_mute:
+        return cmd->value ? bt_vcp_vol_ctlr_mute(vcp_vol_ctlr[conn_idx]) :
+                            bt_vcp_vol_ctlr_unmute(vcp_vol_ctlr[conn_idx]);
+    case ble_cmd_vcs_step:
+        /* Turning the volume up also unmutes, as on the device itself */
+        return (cmd->value > 0) ? bt_vcp_vol_ctlr_unmute_vol_up(vcp_vol_ctlr[conn_idx]) :
+                                  bt_vcp_vol_ctlr_vol_down(vcp_vol_ctlr[conn_idx]);
+    case ble_cmd_vocs_offset:
+        if (inst_idx >= vcp_included[conn_idx].vocs_cnt) {
+            return -EINVAL;
+        }
+
+        return bt_vocs_state_set(vcp_included[conn_idx].vocs[inst_idx], cmd->value);
+    case ble_cmd_aics_gain:
+        if (inst_idx >= vcp_included[conn_idx].aics_cnt) {
+            return -EINVAL;
+        }
+
+        return bt_aics_gain_set(vcp_included[conn_idx].aics[inst_idx], cmd->value);
+    case ble_cmd_aics_mute:
+        if (inst_idx >= vcp_included[conn_idx].aics_cnt) {
+            return -EINVAL;
+        }
+
+        return cmd->value ? bt_aics_mute(vcp_included[conn_idx].aics[inst_idx]) :
+                            bt_aics_unmute(vcp_included[conn_idx].aics[inst_idx]);
+    case ble_cmd_vocs_read:
+        if (inst_idx >= vcp_included[conn_idx].vocs_cnt) {
+            return -EINVAL;
+        }
+
+        return bt_vocs_state_get(vcp_included[conn_idx].vocs[inst_idx]);
+    case ble_cmd_aics_read:
+        if (inst_idx >= vcp_included[conn_idx].aics_cnt) {
+            return -EINVAL;
+        }
+
+        return bt_aics_state_get(vcp_included[conn_idx].aics[inst_idx]);
+    default:
+        return -EINVAL;
     }
+}
+
+static int vcp_cmd_submit(ble_cmd_type_t type, uint8_t conn_idx, uint8_t inst_idx, int16_t value)
+{
+    const ble_cmd_t cmd = {
+        .type = type,
+        .conn_idx = conn_idx,
+        .inst_idx = inst_idx,
+        .value = value,
+    };
 
-    result = bt_vcp_vol_ctlr_set_vol(vcp_vol_ctlr[conn_idx], volume);
+    ble_link_activity(conn_idx);
 
-    if (result != 0) {
-        printk("Connection %d: volume set failed: %d\n", conn_idx, result);
+    /* The group waits for the echo of a write, also on instances not shown */
+    if (type == ble_cmd_vocs_offset) {
+        ble_subs_hold(conn_idx, vcp_vocs_state, inst_idx);
+    } else if ((type == ble_cmd_aics_gain) || (type == ble_cmd_aics_mute)) {
+        ble_subs_hold(conn_idx, vcp_aics_state, inst_idx);
+    }
+
+    int err = ble_cmd_submit(&cmd);
+    if (err) {
+        printk("Connection %d: command %d not queued: %d\n", conn_idx, type, err);
         return -1;
     }
 
     return 0;
 }
 
-int ble_update_volume_mute(uint8_t conn_idx, uint8_t mute)
+int ble_update_volume(uint8_t conn_idx, uint8_t volume)
 {
-    int result;
-
     if (ble_conn[conn_idx] == NULL) {
         printk("Connection %d: not connected!\n", conn_idx);
         return -2;
     }
 
-    if (mute) {
-        result = bt_vcp_vol_ctlr_mute(vcp_vol_ctlr[conn_idx]);
+    return vcp_cmd_submit(ble_cmd_vcs_volume, conn_idx, 0, volume);
+}
 
-    } else {
-        result = bt_vcp_vol_ctlr_unmute(vcp_vol_ctlr[conn_idx]);
+int ble_step_volume(uint8_t conn_idx, int8_t steps)
+{
+    if (ble_conn[conn_idx] == NULL) {
+        printk("Connection %d: not connected!\n", conn_idx);
+        return -2;
     }
 
-    if (result != 0) {
-        printk("Connection %d: volume mute/unmute set failed: %d\n", conn_idx, result);
-        return -1;
+    return vcp_cmd_submit(ble_cmd_vcs_step, conn_idx, 0, steps);
+}
+
+int ble_update_volume_mute(uint8_t conn_idx, uint8_t mute)
+{
+    if (ble_conn[conn_idx] == NULL) {
+        printk("Connection %d: not connected!\n", conn_idx);
+        return -2;
     }
 
-    return 0;
+    return vcp_cmd_submit(ble_cmd_vcs_mute, conn_idx, 0, mute);
 }
 
 int ble_update_vocs_offset(uint8_t conn_idx, uint8_t inst_idx, int16_t offset)
 {
-    int result;
+    if (ble_conn[conn_idx] == NULL) {
+        printk("Connection %d: not connected!\n", conn_idx);
+        return -2;
+    }
 
-    if(inst_idx > vcp_included[conn_idx].vocs_cnt) {
+    if(inst_idx >= vocs_cnt[conn_idx]) {
         printk("Connection %d: VOCS inst. index is not valid: %d\n", conn_idx, inst_idx);
         return -1;
     }
 
-    result = bt_vocs_state_set(vcp_included[conn_idx].vocs[inst_idx], offset);
-    if (result != 0) {
-        printk("Connection %d: VOCS offset set failed: %d\n", conn_idx, result);
+    return vcp_cmd_submit(ble_cmd_vocs_offset, conn_idx, inst_idx, offset);
+}
+
+int ble_update_aics_gain(uint8_t conn_idx, uint8_t inst_idx, int8_t gain)
+{
+    if (ble_conn[conn_idx] == NULL) {
+        printk("Connection %d: not connected!\n", conn_idx);
+        return -2;
+    }
+
+    if(inst_idx >= aics_cnt[conn_idx]) {
+        printk("Connection %d: AICS inst. index is not valid: %d\n", conn_idx, inst_idx);
         return -1;
     }
 
-    return 0;
+    return vcp_cmd_submit(ble_cmd_aics_gain, conn_idx, inst_idx, gain);
 }
 
-int ble_update_aics_gain(uint8_t conn_idx, uint8_t inst_idx, int8_t gain)
+int ble_update_aics_mute(uint8_t conn_idx, uint8_t inst_idx, uint8_t mute)
 {
-    int result;
+    if (ble_conn[conn_idx] == NULL) {
+        printk("Connection %d: not connected!\n", conn_idx);
+        return -2;
+    }
 
-    if(inst_idx > vcp_included[conn_idx].aics_cnt) {
+    if(inst_idx >= aics_cnt[conn_idx]) {
         printk("Connection %d: AICS inst. index is not valid: %d\n", conn_idx, inst_idx);
         return -1;
     }
 
-    result = bt_aics_gain_set(vcp_included[conn_idx].aics[inst_idx], gain);
-    if (result != 0) {
-        printk("Connection %d: AICS gain set failed: %d\n", conn_idx, result);
-        return -1;
+    return vcp_cmd_submit(ble_cmd_aics_mute, conn_idx, inst_idx, mute);
+}
+
+/* Changes made while notifications were off are caught up by reading the state */
+static void vcp_resync(uint8_t conn_idx, vcp_type_t type, uint8_t inst_idx)
+{
+    if (ble_conn[conn_idx] == NULL) {
+        return;
     }
 
-    return 0;
+    vcp_cmd_submit((type == vcp_vocs_state) ? ble_cmd_vocs_read : ble_cmd_aics_read,
+                   conn_idx, inst_idx, 0);
 }
 
-int ble_update_aics_mute(uint8_t conn_idx, uint8_t inst_idx, uint8_t mute)
+int ble_vcp_subscribe(uint8_t conn_idx, vcp_type_t type, uint8_t inst_idx, bool subscribe)
 {
-    int result;
+    if (conn_idx >= BLE_CONN_CNT) {
+        return -EINVAL;
+    }
 
-    if(inst_idx > vcp_included[conn_idx].aics_cnt) {
-        printk("Connection %d: AICS inst. index is not valid: %d\n", conn_idx, inst_idx);
+    return ble_subs_set(conn_idx, type, inst_idx, subscribe);
+}
+
+static int auto_conn_to_idx(struct bt_conn *conn, uint8_t conn_err)
+{
+    if (!auto_conn_running) {
         return -1;
     }
 
-    if (mute) {
-        result = bt_aics_mute(vcp_included[conn_idx].aics[inst_idx]);
+    auto_conn_running = false;
 
-    } else {
-        result = bt_aics_unmute(vcp_included[conn_idx].aics[inst_idx]);
+    if (conn_err) {
+        printk("Auto connect failed (err %u)\n", conn_err);
+        return -1;
     }
 
-    if (result != 0) {
-        printk("Connection %d: AICS mute/unmute set failed: %d\n", conn_idx, result);
+    int conn_idx = ble_bond_find(bt_conn_get_dst(conn));
+    if ((conn_idx == -1) || (ble_conn[conn_idx] != NULL)) {
+        printk("Auto connected to an unexpected device!\n");
+        bt_conn_disconnect(conn, BT_HCI_ERR_REMOTE_USER_TERM_CONN);
         return -1;
     }
 
-    return 0;
+    ble_conn[conn_idx] = bt_conn_ref(conn);
+    ble_reg_conn_add(conn, conn_idx);
+
+    /* The connect phase started when the controller was armed */
+    bringup_enter(conn_idx, phase_connect);
+    bringup[conn_idx].phase_start_ms = auto_conn_start_ms;
+
+    return conn_idx;
 }
 
 static void connected(struct bt_conn *conn, uint8_t conn_err)
 {
-    int conn_idx = -1;
+    int conn_idx = conn_to_idx(conn);
 
-    for (int i = 0; i < BLE_CONN_CNT; i++) {
-        if (conn == ble_conn[i]) {
-            conn_idx = i;
-        }
+    if (conn_idx == -1) {
+        conn_idx = auto_conn_to_idx(conn, conn_err);
     }
 
     if (conn_idx == -1) {
+        connect_next_pending();
         return;
     }
 
     if (conn_err) {
         printk("Connection failed (conn=%d, err=%u)\n", conn_idx, conn_err);
+        ble_reg_conn_remove(conn, conn_idx);
         bt_conn_unref(conn);
+        ble_conn[conn_idx] = NULL;
+        bringup_fail(conn_idx, conn_err);
+        connect_next_pending();
         return;
     }
 
@@ -497,17 +1300,18 @@ static void connected(struct bt_conn *conn, uint8_t conn_err)
     if (user_conn_status_cb) {
         user_conn_status_cb(conn_idx, conn_connected);
     }
+
+    ble_link_connected(conn_idx, conn);
+
+    /* The initiator is free, let the next device connect while this one is set up */
+    connect_next_pending();
+
+    bringup_mtu(conn_idx);
 }
 
 static void disconnected(struct bt_conn *conn, uint8_t reason)
 {
-    int conn_idx = -1;
-
-    for (int i = 0; i < BLE_CONN_CNT; i++) {
-        if (conn == ble_conn[i]) {
-            conn_idx = i;
-        }
-    }
+    int conn_idx = conn_to_idx(conn);
 
     if (conn_idx == -1) {
         return;
@@ -515,16 +1319,72 @@ static void disconnected(struct bt_conn *conn, uint8_t reason)
 
     ble_dev_connected[conn_idx] = false;
     printk("Connection %d: disconnected (reason %u)\n", conn_idx,reason);
+    ble_cmd_conn_reset(conn_idx);
+    ble_link_disconnected(conn_idx);
+    ble_subs_disconnected(conn_idx);
+    ble_reg_conn_remove(conn, conn_idx);
     bt_conn_unref(ble_conn[conn_idx]);
+    ble_conn[conn_idx] = NULL;
+    bringup[conn_idx].phase = phase_idle;
+
+    /* The volume controller drops its instances on disconnect */
+    memset(&vcp_included[conn_idx], 0, sizeof(vcp_included[conn_idx]));
+    vocs_cnt[conn_idx] = 0;
+    aics_cnt[conn_idx] = 0;
 
     if (user_conn_status_cb) {
         user_conn_status_cb(conn_idx, conn_disconnected);
     }
+
+    auto_connect_resume();
+}
+
+static void security_changed(struct bt_conn *conn, bt_security_t level,
+                             enum bt_security_err err)
+{
+    int conn_idx = conn_to_idx(conn);
+
+    if ((conn_idx == -1) || (bringup[conn_idx].phase != phase_security)) {
+        return;
+    }
+
+    if (err) {
+        printk("Connection %d: security failed (err %d)\n", conn_idx, err);
+    } else {
+        printk("Connection %d: security level %d\n", conn_idx, level);
+    }
+
+    /* Pairing is only needed to bond, go on with discovery either way */
+    bringup_discover(conn_idx);
+}
+
+static void pairing_complete(struct bt_conn *conn, bool bonded)
+{
+    int conn_idx = conn_to_idx(conn);
+
+    if ((conn_idx == -1) || !bonded) {
+        return;
+    }
+
+    ble_bond_store(conn_idx, bt_conn_get_dst(conn));
+}
+
+static void bond_deleted(uint8_t id, const bt_addr_le_t *peer)
+{
+    if (id == BT_ID_DEFAULT) {
+        ble_bond_deleted(peer);
+    }
 }
 
 static struct bt_conn_cb conn_callbacks = {
     .connected = connected,
     .disconnected = disconnected,
+    .security_changed = security_changed,
+};
+
+static struct bt_conn_auth_info_cb auth_info_callbacks = {
+    .pairing_complete = pairing_complete,
+    .bond_deleted = bond_deleted,
 };
 
 int ble_bt_init(void)
@@ -537,9 +1397,31 @@ int ble_bt_init(void)
         return -1;
     }
 
+    err = ble_bond_init(dev_name);
+    if (err) {
+        printk("Bond init failed! (err %d)\n", err);
+    }
+
     k_work_init_delayable(&scan_timeout_work, scan_timeout_cb);
+    k_work_init_delayable(&scan_settle_work, scan_settle_cb);
+
+    err = ble_cmd_init(vcp_cmd_write);
+    if (err) {
+        printk("Command queue init failed: %d\n", err);
+        return -3;
+    }
 
     bt_conn_cb_register(&conn_callbacks);
+    bt_conn_auth_info_cb_register(&auth_info_callbacks);
+    ble_link_init();
+    ble_subs_init(vcp_resync);
+
+#if defined(CONFIG_BLE_GROUP_CSIP)
+    err = ble_set_init(set_discovered);
+    if (err) {
+        printk("Set coordinator init failed: %d\n", err);
+    }
+#endif
 
     err = bt_vcp_vol_ctlr_cb_register(&vcp_cbs);
     if (err) {
@@ -51,6 +51,7 @@ typedef struct
     int err;
     uint8_t vocs_count;
     uint8_t aics_count;
+    bool cached;
 } vcp_discover_t;
 
 typedef struct
@@ -99,13 +100,17 @@ int ble_stop_scan(void);
 int ble_start_scan(void);
 int ble_start_scan_force(void);
 int ble_connect(uint8_t conn_idx);
+int ble_auto_connect_start(void);
 int ble_disconnect(uint8_t conn_idx);
 int ble_vcp_discover(uint8_t conn_idx);
+int ble_att_bearer_count(uint8_t conn_idx);
 int ble_update_volume(uint8_t conn_idx, uint8_t volume);
+int ble_step_volume(uint8_t conn_idx, int8_t steps);
 int ble_update_volume_mute(uint8_t conn_idx, uint8_t mute);
 int ble_update_vocs_offset(uint8_t conn_idx, uint8_t inst_idx, int16_t offset);
 int ble_update_aics_gain(uint8_t conn_idx, uint8_t inst_idx, int8_t gain);
 int ble_update_aics_mute(uint8_t conn_idx, uint8_t inst_idx, uint8_t mute);
+int ble_vcp_subscribe(uint8_t conn_idx, vcp_type_t type, uint8_t inst_idx, bool subscribe);
 
 void ble_scan_status_cb_register(scan_status_callback_t *scan_status_cb);
 void ble_conn_status_cb_register(conn_status_callback_t *conn_status_cb);
@@ -0,0 +1,179 @@
+/*
+ * Copyright (c) 2024 Demant A/S
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+/* Bonded peer persistence
+ *
+ * Maps each connection slot to the identity address of the peer bonded on
+ * that slot. The mapping is kept in the settings subsystem next to the bond
+ * keys stored by the Bluetooth host, so that bonded peers can be reconnected
+ * on boot without scanning for their names.
+ */
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <zephyr/kernel.h>
+#include <zephyr/sys/printk.h>
+#include <zephyr/settings/settings.h>
+#include <zephyr/bluetooth/bluetooth.h>
+
+#include "ble_bond.h"
+
+
+#define BOND_SETTINGS_KEY   "vcpc/bond"
+
+struct bond_slot {
+    bt_addr_le_t addr;
+    char name[MAX_DEVICE_NAME_LEN];
+};
+
+static struct bond_slot bond_slots[BLE_CONN_CNT];
+static bool bond_slot_valid[BLE_CONN_CNT];
+/* Valid slots whose name still matches and whose keys are held by the host */
+static bool bond_slot_usable[BLE_CONN_CNT];
+static const char *const *bond_slot_names;
+
+
+/* Slots without a configured name, e.g. coordinated set members, are kept under "" */
+static const char *bond_slot_name(uint8_t conn_idx)
+{
+    return (bond_slot_names[conn_idx] != NULL) ? bond_slot_names[conn_idx] : "";
+}
+
+static int bond_settings_set(const char *name, size_t len, settings_read_cb read_cb,
+                             void *cb_arg)
+{
+    char *end;
+    unsigned long slot = strtoul(name, &end, 10);
+
+    if ((end == name) || (*end != '\0') || (slot >= BLE_CONN_CNT)) {
+        return -ENOENT;
+    }
+
+    if (len != sizeof(bond_slots[slot])) {
+        return -EINVAL;
+    }
+
+    ssize_t rc = read_cb(cb_arg, &bond_slots[slot], sizeof(bond_slots[slot]));
+    if (rc < 0) {
+        return rc;
+    }
+
+    bond_slots[slot].name[MAX_DEVICE_NAME_LEN - 1] = '\0';
+    bond_slot_valid[slot] = true;
+
+    return 0;
+}
+
+SETTINGS_STATIC_HANDLER_DEFINE(vcpc_bond, BOND_SETTINGS_KEY, NULL, bond_settings_set,
+                               NULL, NULL);
+
+static void bond_validate_cb(const struct bt_bond_info *info, void *user_data)
+{
+    bool *found = user_data;
+
+    for (uint8_t i = 0; i < BLE_CONN_CNT; i++) {
+        if (bt_addr_le_eq(&info->addr, &bond_slots[i].addr)) {
+            found[i] = true;
+        }
+    }
+}
+
+/* Run once the mapping is loaded, store and delete keep the result up to date after that */
+static void bond_validate(void)
+{
+    bool found[BLE_CONN_CNT] = { false };
+
+    /* The host may have dropped the keys, e.g. to make room for a new bond */
+    bt_foreach_bond(BT_ID_DEFAULT, bond_validate_cb, found);
+
+    for (uint8_t i = 0; i < BLE_CONN_CNT; i++) {
+        /* The slot is reassigned when the configured device name changes */
+        bond_slot_usable[i] = bond_slot_valid[i] && found[i] &&
+                              !strcmp(bond_slots[i].name, bond_slot_name(i));
+    }
+}
+
+bool ble_bond_get(uint8_t conn_idx, bt_addr_le_t *addr)
+{
+    if ((conn_idx >= BLE_CONN_CNT) || !bond_slot_usable[conn_idx]) {
+        return false;
+    }
+
+    bt_addr_le_copy(addr, &bond_slots[conn_idx].addr);
+
+    return true;
+}
+
+int ble_bond_find(const bt_addr_le_t *addr)
+{
+    for (uint8_t i = 0; i < BLE_CONN_CNT; i++) {
+        if (bond_slot_usable[i] && bt_addr_le_eq(&bond_slots[i].addr, addr)) {
+            return i;
+        }
+    }
+
+    return -1;
+}
+
+int ble_bond_store(uint8_t conn_idx, const bt_addr_le_t *addr)
+{
+    char key[sizeof(BOND_SETTINGS_KEY) + 4];
+
+    if (conn_idx >= BLE_CONN_CNT) {
+        return -EINVAL;
+    }
+
+    if (bond_slot_valid[conn_idx] && bt_addr_le_eq(&bond_slots[conn_idx].addr, addr) &&
+        !strcmp(bond_slots[conn_idx].name, bond_slot_name(conn_idx))) {
+        /* Paired again, the host holds new keys */
+        bond_slot_usable[conn_idx] = true;
+        return 0;
+    }
+
+    bt_addr_le_copy(&bond_slots[conn_idx].addr, addr);
+    strncpy(bond_slots[conn_idx].name, bond_slot_name(conn_idx), MAX_DEVICE_NAME_LEN - 1);
+    bond_slots[conn_idx].name[MAX_DEVICE_NAME_LEN - 1] = '\0';
+    bond_slot_valid[conn_idx] = true;
+    bond_slot_usable[conn_idx] = true;
+
+    snprintk(key, sizeof(key), BOND_SETTINGS_KEY "/%u", conn_idx);
+
+    int err = settings_save_one(key, &bond_slots[conn_idx], sizeof(bond_slots[conn_idx]));
+    if (err) {
+        printk("Connection %d: storing bond failed (err %d)\n", conn_idx, err);
+        return err;
+    }
+
+    printk("Connection %d: bond stored.\n", conn_idx);
+
+    return 0;
+}
+
+void ble_bond_deleted(const bt_addr_le_t *addr)
+{
+    for (uint8_t i = 0; i < BLE_CONN_CNT; i++) {
+        if (bond_slot_usable[i] && bt_addr_le_eq(&bond_slots[i].addr, addr)) {
+            bond_slot_usable[i] = false;
+            printk("Connection %d: bond deleted.\n", i);
+        }
+    }
+}
+
+int ble_bond_init(const char *const *slot_names)
+{
+    bond_slot_names = slot_names;
+
+    /* Loads the host's bond keys as well as the slot mapping */
+    int err = settings_load();
+    if (err) {
+        printk("Settings load failed (err %d)\n", err);
+        return err;
+    }
+
+    bond_validate();
+
+    return 0;
+}
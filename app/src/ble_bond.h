@@ -0,0 +1,22 @@
+/*
+ * Copyright (c) 2024 Demant A/S
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+/* Header for bonded peer persistence */
+
+#ifndef __BLE_BOND_H
+#define __BLE_BOND_H
+
+#include <zephyr/bluetooth/bluetooth.h>
+
+#include "ble.h"
+
+
+int ble_bond_init(const char *const *slot_names);
+bool ble_bond_get(uint8_t conn_idx, bt_addr_le_t *addr);
+int ble_bond_find(const bt_addr_le_t *addr);
+int ble_bond_store(uint8_t conn_idx, const bt_addr_le_t *addr);
+void ble_bond_deleted(const bt_addr_le_t *addr);
+
+#endif /* __BLE_BOND_H */
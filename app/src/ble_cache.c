@@ -0,0 +1,117 @@
+/*
+ * Copyright (c) 2024 Demant A/S
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+/* VCP discovery cache
+ *
+ * Keeps the VOCS/AICS instance layout discovered on each bonded peer. On
+ * reconnect the layout of the peer bonded on the slot is known without any
+ * ATT request, so it can be used before discovery has completed. Discovery
+ * still runs and refreshes the entry when the layout has changed.
+ */
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <zephyr/kernel.h>
+#include <zephyr/sys/printk.h>
+#include <zephyr/settings/settings.h>
+#include <zephyr/bluetooth/bluetooth.h>
+
+#include "ble_cache.h"
+#include "ble_bond.h"
+
+
+#define CACHE_SETTINGS_KEY  "vcpc/cache"
+
+struct cache_entry {
+    bt_addr_le_t addr;
+    ble_cache_layout_t layout;
+};
+
+static struct cache_entry cache_entries[BLE_CONN_CNT];
+static bool cache_entry_valid[BLE_CONN_CNT];
+
+
+static int cache_settings_set(const char *name, size_t len, settings_read_cb read_cb,
+                              void *cb_arg)
+{
+    char *end;
+    unsigned long slot = strtoul(name, &end, 10);
+
+    if ((end == name) || (*end != '\0') || (slot >= BLE_CONN_CNT)) {
+        return -ENOENT;
+    }
+
+    if (len != sizeof(cache_entries[slot])) {
+        return -EINVAL;
+    }
+
+    ssize_t rc = read_cb(cb_arg, &cache_entries[slot], sizeof(cache_entries[slot]));
+    if (rc < 0) {
+        return rc;
+    }
+
+    cache_entry_valid[slot] = true;
+
+    return 0;
+}
+
+SETTINGS_STATIC_HANDLER_DEFINE(vcpc_cache, CACHE_SETTINGS_KEY, NULL, cache_settings_set,
+                               NULL, NULL);
+
+static bool cache_entry_matches(uint8_t conn_idx)
+{
+    bt_addr_le_t addr;
+
+    if (!cache_entry_valid[conn_idx]) {
+        return false;
+    }
+
+    /* Only trust entries of the peer currently bonded on this slot */
+    return ble_bond_get(conn_idx, &addr) && bt_addr_le_eq(&addr, &cache_entries[conn_idx].addr);
+}
+
+bool ble_cache_get(uint8_t conn_idx, ble_cache_layout_t *layout)
+{
+    if ((conn_idx >= BLE_CONN_CNT) || !cache_entry_matches(conn_idx)) {
+        return false;
+    }
+
+    *layout = cache_entries[conn_idx].layout;
+
+    return true;
+}
+
+void ble_cache_update(uint8_t conn_idx, const ble_cache_layout_t *layout)
+{
+    char key[sizeof(CACHE_SETTINGS_KEY) + 4];
+    struct cache_entry *entry;
+    bt_addr_le_t addr;
+
+    if (conn_idx >= BLE_CONN_CNT) {
+        return;
+    }
+
+    entry = &cache_entries[conn_idx];
+
+    if (!ble_bond_get(conn_idx, &addr)) {
+        return;
+    }
+
+    if (cache_entry_matches(conn_idx) && !memcmp(&entry->layout, layout, sizeof(*layout))) {
+        return;
+    }
+
+    bt_addr_le_copy(&entry->addr, &addr);
+    entry->layout = *layout;
+    cache_entry_valid[conn_idx] = true;
+
+    snprintk(key, sizeof(key), CACHE_SETTINGS_KEY "/%u", conn_idx);
+
+    int err = settings_save_one(key, entry, sizeof(*entry));
+    if (err) {
+        printk("Connection %d: storing discovery cache failed (err %d)\n", conn_idx, err);
+    }
+}
@@ -0,0 +1,24 @@
+/*
+ * Copyright (c) 2024 Demant A/S
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+/* Header for the VCP discovery cache */
+
+#ifndef __BLE_CACHE_H
+#define __BLE_CACHE_H
+
+#include "ble.h"
+
+
+typedef struct
+{
+    uint8_t vocs_count;
+    uint8_t aics_count;
+} ble_cache_layout_t;
+
+
+bool ble_cache_get(uint8_t conn_idx, ble_cache_layout_t *layout);
+void ble_cache_update(uint8_t conn_idx, const ble_cache_layout_t *layout);
+
+#endif /* __BLE_CACHE_H */
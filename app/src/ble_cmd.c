@@ -0,0 +1,504 @@
+/*
+ * Copyright (c) 2024 Demant A/S
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+/* Outbound VCP command queue
+ *
+ * Every connection owns one queue per control point (VCS, each VOCS and each
+ * AICS instance). Commands are issued from a dedicated workqueue with at most
+ * one ATT write in flight per control point. Writes rejected by the host with
+ * -EBUSY or -ENOMEM stay at the head of their queue and are retried later.
+ *
+ * Commands carrying absolute values replace a queued command of the same type
+ * (latest value wins). Volume steps are added to a queued step instead, so
+ * that presses cancel out and a burst is issued as its net number of steps,
+ * one relative opcode at a time. Writes on a control point
+ * are paced relative to its smoothed write-response time.
+ *
+ * Control points are independent of each other, so with Enhanced ATT the
+ * writes of different control points run in parallel on separate bearers.
+ *
+ * Commands submitted within a batch, e.g. the same change for every device of
+ * a group, are held back until the batch is closed and then issued together
+ * in one pass of the workqueue, paced by the slowest of their control points.
+ */
+
+#include <errno.h>
+#include <string.h>
+#include <zephyr/kernel.h>
+#include <zephyr/sys/printk.h>
+#include <zephyr/shell/shell.h>
+
+#include "ble_cmd.h"
+
+
+#define BLE_CMD_WORKQ_STACK_SIZE    CONFIG_BLE_CMD_WORKQ_STACK_SIZE
+#define BLE_CMD_WORKQ_PRIO          K_PRIO_PREEMPT(5)
+#define BLE_CMD_PACE_PCT            CONFIG_BLE_CMD_PACE_PCT
+#define BLE_CMD_PACE_MAX_US         (CONFIG_BLE_CMD_PACE_MAX_MS * 1000U)
+
+/* Smoothing factor of the write-response time: srtt += (rtt - srtt) / 8 */
+#define BLE_CMD_SRTT_SHIFT          3
+
+struct cmd_chan {
+    ble_cmd_t queue[BLE_CMD_QUEUE_DEPTH];
+    uint8_t head;
+    uint8_t count;
+    uint8_t retries;
+    bool in_flight;
+    uint32_t issued_cyc;
+    uint32_t next_issue_cyc;
+    uint32_t srtt_us;
+};
+
+struct cmd_stats {
+    uint32_t issued;
+    uint32_t completed;
+    uint32_t failed;
+    uint32_t coalesced;
+    uint32_t busy_retries;
+    uint32_t parallel;
+    uint32_t rtt_max_us;
+    uint8_t in_flight;
+    uint8_t in_flight_max;
+};
+
+struct cmd_conn {
+    struct k_work_delayable work;
+    struct cmd_chan chan[BLE_CMD_CHAN_CNT];
+    struct cmd_stats stats;
+    bool hold;
+};
+
+BUILD_ASSERT(BLE_CMD_CHAN_CNT <= 32, "Batch masks hold up to 32 control points");
+
+static struct cmd_conn cmd_conns[BLE_CONN_CNT];
+static struct k_spinlock cmd_lock;
+
+/* Control points with commands of the open batch, per connection */
+static uint32_t batch_chans[BLE_CONN_CNT];
+static uint8_t batch_depth;
+
+static struct k_work_q cmd_workq;
+static K_THREAD_STACK_DEFINE(cmd_workq_stack, BLE_CMD_WORKQ_STACK_SIZE);
+
+static ble_cmd_write_t *cmd_write = NULL;
+static ble_cmd_status_callback_t *user_cmd_status_cb = NULL;
+
+
+static int cmd_chan_idx(ble_cmd_type_t type, uint8_t inst_idx)
+{
+    switch (type) {
+    case ble_cmd_vcs_volume:
+    case ble_cmd_vcs_mute:
+    case ble_cmd_vcs_step:
+        return 0;
+    case ble_cmd_vocs_offset:
+    case ble_cmd_vocs_read:
+        return (inst_idx < VCP_MAX_VOCS_INST) ? (1 + inst_idx) : -1;
+    case ble_cmd_aics_gain:
+    case ble_cmd_aics_mute:
+    case ble_cmd_aics_read:
+        return (inst_idx < VCP_MAX_AICS_INST) ? (1 + VCP_MAX_VOCS_INST + inst_idx) : -1;
+    default:
+        return -1;
+    }
+}
+
+static void cmd_chan_pop(struct cmd_chan *chan)
+{
+    chan->head = (chan->head + 1) % BLE_CMD_QUEUE_DEPTH;
+    chan->count--;
+    chan->retries = 0;
+    chan->in_flight = false;
+}
+
+static void cmd_chan_pace(struct cmd_chan *chan, uint32_t rtt_us)
+{
+    if (chan->srtt_us == 0) {
+        chan->srtt_us = rtt_us;
+    } else {
+        chan->srtt_us += ((int32_t)rtt_us - (int32_t)chan->srtt_us) >> BLE_CMD_SRTT_SHIFT;
+    }
+
+    /* The write just completed took the first srtt, hold off for the rest of the gap */
+    uint32_t gap_us = MIN((uint64_t)chan->srtt_us * BLE_CMD_PACE_PCT / 100, BLE_CMD_PACE_MAX_US);
+    gap_us = (gap_us > chan->srtt_us) ? (gap_us - chan->srtt_us) : 0;
+
+    chan->next_issue_cyc = k_cycle_get_32() + k_us_to_cyc_ceil32(gap_us);
+}
+
+static void cmd_work_handler(struct k_work *work)
+{
+    struct k_work_delayable *dwork = k_work_delayable_from_work(work);
+    struct cmd_conn *cc = CONTAINER_OF(dwork, struct cmd_conn, work);
+    bool retry = false;
+    uint32_t pace_wait_us = UINT32_MAX;
+
+    /* Commands queued while the connection is being set up are issued once it is ready */
+    if (cc->hold) {
+        return;
+    }
+
+    for (int i = 0; i < BLE_CMD_CHAN_CNT; i++) {
+        struct cmd_chan *chan = &cc->chan[i];
+        k_spinlock_key_t key = k_spin_lock(&cmd_lock);
+
+        if (chan->in_flight || (chan->count == 0)) {
+            k_spin_unlock(&cmd_lock, key);
+            continue;
+        }
+
+        int32_t wait_cyc = (int32_t)(chan->next_issue_cyc - k_cycle_get_32());
+        if (wait_cyc > 0) {
+            pace_wait_us = MIN(pace_wait_us, k_cyc_to_us_ceil32(wait_cyc));
+            k_spin_unlock(&cmd_lock, key);
+            continue;
+        }
+
+        ble_cmd_t cmd = chan->queue[chan->head];
+
+        /* Steps that cancelled out leave nothing to write */
+        if ((cmd.type == ble_cmd_vcs_step) && (cmd.value == 0)) {
+            cmd_chan_pop(chan);
+            k_spin_unlock(&cmd_lock, key);
+            i--;
+            continue;
+        }
+
+        /* Mark in flight first, the completion may arrive before the write returns */
+        chan->in_flight = true;
+        chan->issued_cyc = k_cycle_get_32();
+
+        if (cc->stats.in_flight > 0) {
+            cc->stats.parallel++;
+        }
+
+        cc->stats.in_flight++;
+        cc->stats.in_flight_max = MAX(cc->stats.in_flight_max, cc->stats.in_flight);
+        cc->stats.issued++;
+        k_spin_unlock(&cmd_lock, key);
+
+        int err = cmd_write(&cmd);
+        if (err == 0) {
+            continue;
+        }
+
+        key = k_spin_lock(&cmd_lock);
+        chan->in_flight = false;
+        cc->stats.in_flight--;
+        cc->stats.issued--;
+
+        if (((err == -EBUSY) || (err == -ENOMEM)) && (chan->retries < BLE_CMD_RETRY_MAX)) {
+            chan->retries++;
+            cc->stats.busy_retries++;
+            retry = true;
+            k_spin_unlock(&cmd_lock, key);
+            continue;
+        }
+
+        cmd_chan_pop(chan);
+        cc->stats.failed++;
+        k_spin_unlock(&cmd_lock, key);
+
+        printk("Connection %d: command %d dropped (err %d)\n", cmd.conn_idx, cmd.type, err);
+
+        if (user_cmd_status_cb) {
+            user_cmd_status_cb(&cmd, err, 0);
+        }
+    }
+
+    if (retry) {
+        pace_wait_us = MIN(pace_wait_us, BLE_CMD_RETRY_DELAY_MS * 1000U);
+    }
+
+    if (pace_wait_us != UINT32_MAX) {
+        k_work_reschedule_for_queue(&cmd_workq, &cc->work, K_USEC(pace_wait_us));
+    }
+}
+
+int ble_cmd_submit(const ble_cmd_t *cmd)
+{
+    if (cmd->conn_idx >= BLE_CONN_CNT) {
+        return -EINVAL;
+    }
+
+    int chan_idx = cmd_chan_idx(cmd->type, cmd->inst_idx);
+    if (chan_idx < 0) {
+        return -EINVAL;
+    }
+
+    struct cmd_conn *cc = &cmd_conns[cmd->conn_idx];
+    struct cmd_chan *chan = &cc->chan[chan_idx];
+    k_spinlock_key_t key = k_spin_lock(&cmd_lock);
+
+    /* Replace a queued command of the same type, the one in flight is left alone */
+    for (uint8_t i = chan->in_flight ? 1 : 0; i < chan->count; i++) {
+        ble_cmd_t *queued = &chan->queue[(chan->head + i) % BLE_CMD_QUEUE_DEPTH];
+
+        if (queued->type == cmd->type) {
+            if (cmd->type == ble_cmd_vcs_step) {
+                queued->value += cmd->value;
+            } else {
+                queued->value = cmd->value;
+            }
+
+            cc->stats.coalesced++;
+            k_spin_unlock(&cmd_lock, key);
+            return 0;
+        }
+    }
+
+    if (chan->count >= BLE_CMD_QUEUE_DEPTH) {
+        k_spin_unlock(&cmd_lock, key);
+        printk("Connection %d: command queue %d full!\n", cmd->conn_idx, chan_idx);
+        return -ENOMEM;
+    }
+
+    chan->queue[(chan->head + chan->count) % BLE_CMD_QUEUE_DEPTH] = *cmd;
+    chan->count++;
+
+    if (batch_depth > 0) {
+        batch_chans[cmd->conn_idx] |= BIT(chan_idx);
+        k_spin_unlock(&cmd_lock, key);
+        return 0;
+    }
+
+    k_spin_unlock(&cmd_lock, key);
+
+    k_work_schedule_for_queue(&cmd_workq, &cc->work, K_NO_WAIT);
+
+    return 0;
+}
+
+void ble_cmd_batch_begin(void)
+{
+    k_spinlock_key_t key = k_spin_lock(&cmd_lock);
+    batch_depth++;
+    k_spin_unlock(&cmd_lock, key);
+}
+
+void ble_cmd_batch_end(void)
+{
+    uint32_t chans[BLE_CONN_CNT];
+    uint32_t now = k_cycle_get_32();
+    int32_t wait_cyc = 0;
+
+    k_spinlock_key_t key = k_spin_lock(&cmd_lock);
+
+    if ((batch_depth == 0) || (--batch_depth > 0)) {
+        k_spin_unlock(&cmd_lock, key);
+        return;
+    }
+
+    memcpy(chans, batch_chans, sizeof(chans));
+    memset(batch_chans, 0, sizeof(batch_chans));
+
+    /* Wait for the slowest control point, so that no device goes ahead */
+    for (int i = 0; i < BLE_CONN_CNT; i++) {
+        for (int j = 0; j < BLE_CMD_CHAN_CNT; j++) {
+            if (chans[i] & BIT(j)) {
+                wait_cyc = MAX(wait_cyc, (int32_t)(cmd_conns[i].chan[j].next_issue_cyc - now));
+            }
+        }
+    }
+
+    for (int i = 0; i < BLE_CONN_CNT; i++) {
+        for (int j = 0; j < BLE_CMD_CHAN_CNT; j++) {
+            if (chans[i] & BIT(j)) {
+                cmd_conns[i].chan[j].next_issue_cyc = now + wait_cyc;
+            }
+        }
+    }
+
+    k_spin_unlock(&cmd_lock, key);
+
+    /* Equal deadlines expire in the same tick and run back-to-back on the workqueue */
+    k_timeout_t delay = K_USEC(k_cyc_to_us_ceil32(wait_cyc));
+
+    for (int i = 0; i < BLE_CONN_CNT; i++) {
+        if (chans[i]) {
+            k_work_reschedule_for_queue(&cmd_workq, &cmd_conns[i].work, delay);
+        }
+    }
+}
+
+void ble_cmd_complete(uint8_t conn_idx, ble_cmd_type_t type, uint8_t inst_idx, int err)
+{
+    if (conn_idx >= BLE_CONN_CNT) {
+        return;
+    }
+
+    int chan_idx = cmd_chan_idx(type, inst_idx);
+    if (chan_idx < 0) {
+        return;
+    }
+
+    struct cmd_conn *cc = &cmd_conns[conn_idx];
+    struct cmd_chan *chan = &cc->chan[chan_idx];
+    k_spinlock_key_t key = k_spin_lock(&cmd_lock);
+
+    /* State callbacks complete a read only, they also come for notifications */
+    if (!chan->in_flight || (chan->queue[chan->head].type != type)) {
+        k_spin_unlock(&cmd_lock, key);
+        return;
+    }
+
+    ble_cmd_t *head = &chan->queue[chan->head];
+    ble_cmd_t cmd = *head;
+    uint32_t rtt_us = k_cyc_to_us_floor32(k_cycle_get_32() - chan->issued_cyc);
+    bool more = (chan->count > 1);
+
+    if ((cmd.type == ble_cmd_vcs_step) && !err && ((cmd.value > 1) || (cmd.value < -1))) {
+        /* One step was taken, the rest stays at the head of the queue */
+        cmd.value = (cmd.value > 0) ? 1 : -1;
+        head->value -= cmd.value;
+        chan->in_flight = false;
+        chan->retries = 0;
+        more = true;
+    } else {
+        cmd_chan_pop(chan);
+    }
+
+    cmd_chan_pace(chan, rtt_us);
+
+    cc->stats.in_flight--;
+    cc->stats.completed++;
+    cc->stats.rtt_max_us = MAX(cc->stats.rtt_max_us, rtt_us);
+
+    if (err) {
+        cc->stats.failed++;
+    }
+
+    k_spin_unlock(&cmd_lock, key);
+
+    if (err) {
+        printk("Connection %d: command %d failed (err %d)\n", conn_idx, cmd.type, err);
+    }
+
+    if (user_cmd_status_cb) {
+        user_cmd_status_cb(&cmd, err, rtt_us);
+    }
+
+    if (more) {
+        k_work_reschedule_for_queue(&cmd_workq, &cc->work, K_NO_WAIT);
+    }
+}
+
+void ble_cmd_conn_hold(uint8_t conn_idx, bool hold)
+{
+    if (conn_idx >= BLE_CONN_CNT) {
+        return;
+    }
+
+    struct cmd_conn *cc = &cmd_conns[conn_idx];
+
+    cc->hold = hold;
+
+    if (!hold) {
+        k_work_reschedule_for_queue(&cmd_workq, &cc->work, K_NO_WAIT);
+    }
+}
+
+void ble_cmd_conn_reset(uint8_t conn_idx)
+{
+    if (conn_idx >= BLE_CONN_CNT) {
+        return;
+    }
+
+    struct cmd_conn *cc = &cmd_conns[conn_idx];
+    struct cmd_chan chans[BLE_CMD_CHAN_CNT];
+    uint32_t dropped = 0;
+
+    k_work_cancel_delayable(&cc->work);
+
+    k_spinlock_key_t key = k_spin_lock(&cmd_lock);
+    memcpy(chans, cc->chan, sizeof(chans));
+    memset(cc->chan, 0, sizeof(cc->chan));
+    cc->stats.in_flight = 0;
+    /* An open batch must not reschedule the connection */
+    batch_chans[conn_idx] = 0;
+
+    for (int i = 0; i < BLE_CMD_CHAN_CNT; i++) {
+        dropped += chans[i].count;
+    }
+
+    cc->stats.failed += dropped;
+    k_spin_unlock(&cmd_lock, key);
+
+    if (dropped) {
+        printk("Connection %d: %u command(s) dropped (err %d)\n", conn_idx, dropped, -ENOTCONN);
+    }
+
+    /* The submitters track the commands until they complete, the dropped ones too */
+    for (int i = 0; i < BLE_CMD_CHAN_CNT; i++) {
+        for (uint8_t j = 0; j < chans[i].count; j++) {
+            ble_cmd_t *cmd = &chans[i].queue[(chans[i].head + j) % BLE_CMD_QUEUE_DEPTH];
+
+            if (user_cmd_status_cb) {
+                user_cmd_status_cb(cmd, -ENOTCONN, 0);
+            }
+        }
+    }
+}
+
+int ble_cmd_init(ble_cmd_write_t *write)
+{
+    if (write == NULL) {
+        return -EINVAL;
+    }
+
+    cmd_write = write;
+
+    k_work_queue_init(&cmd_workq);
+    k_work_queue_start(&cmd_workq, cmd_workq_stack, K_THREAD_STACK_SIZEOF(cmd_workq_stack),
+                       BLE_CMD_WORKQ_PRIO, NULL);
+
+    for (int i = 0; i < BLE_CONN_CNT; i++) {
+        k_work_init_delayable(&cmd_conns[i].work, cmd_work_handler);
+    }
+
+    return 0;
+}
+
+void ble_cmd_status_cb_register(ble_cmd_status_callback_t *cmd_status_cb)
+{
+    user_cmd_status_cb = cmd_status_cb;
+}
+
+#if defined(CONFIG_SHELL)
+static int cmd_stats_shell(const struct shell *sh, size_t argc, char **argv)
+{
+    for (uint8_t i = 0; i < BLE_CONN_CNT; i++) {
+        struct cmd_conn *cc = &cmd_conns[i];
+        k_spinlock_key_t key = k_spin_lock(&cmd_lock);
+        struct cmd_stats stats = cc->stats;
+        uint32_t srtt_us[BLE_CMD_CHAN_CNT];
+
+        for (int j = 0; j < BLE_CMD_CHAN_CNT; j++) {
+            srtt_us[j] = cc->chan[j].srtt_us;
+        }
+
+        k_spin_unlock(&cmd_lock, key);
+
+        shell_print(sh, "Connection %d: %d ATT bearer(s)", i, ble_att_bearer_count(i));
+        shell_print(sh, "  issued %u, completed %u, failed %u, coalesced %u, busy retries %u",
+                    stats.issued, stats.completed, stats.failed, stats.coalesced,
+                    stats.busy_retries);
+        shell_print(sh, "  in parallel %u, max in flight %u, max rtt %u us",
+                    stats.parallel, stats.in_flight_max, stats.rtt_max_us);
+
+        for (int j = 0; j < BLE_CMD_CHAN_CNT; j++) {
+            if (srtt_us[j]) {
+                shell_print(sh, "  control point %d: srtt %u us", j, srtt_us[j]);
+            }
+        }
+    }
+
+    return 0;
+}
+
+SHELL_SUBCMD_ADD((vcpc), cmd, NULL, "Show VCP command queue and ATT bearer statistics",
+                 cmd_stats_shell, 1, 0);
+#endif
@@ -0,0 +1,59 @@
+/*
+ * Copyright (c) 2024 Demant A/S
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+/* Header for the outbound VCP command queue */
+
+#ifndef __BLE_CMD_H
+#define __BLE_CMD_H
+
+#include "ble.h"
+
+#define BLE_CMD_QUEUE_DEPTH     CONFIG_BLE_CMD_QUEUE_DEPTH
+#define BLE_CMD_RETRY_MAX       CONFIG_BLE_CMD_RETRY_MAX
+#define BLE_CMD_RETRY_DELAY_MS  CONFIG_BLE_CMD_RETRY_DELAY_MS
+
+/* One channel per control point: VCS, then every VOCS and AICS instance */
+#define BLE_CMD_CHAN_CNT        (1 + VCP_MAX_VOCS_INST + VCP_MAX_AICS_INST)
+
+
+typedef enum
+{
+    ble_cmd_vcs_volume,
+    ble_cmd_vcs_mute,
+    ble_cmd_vocs_offset,
+    ble_cmd_aics_gain,
+    ble_cmd_aics_mute,
+    /* Relative volume steps, the value is the signed number of steps */
+    ble_cmd_vcs_step,
+    /* State reads, completed by the next state callback of the instance */
+    ble_cmd_vocs_read,
+    ble_cmd_aics_read,
+} ble_cmd_type_t;
+
+typedef struct
+{
+    ble_cmd_type_t type;
+    uint8_t conn_idx;
+    uint8_t inst_idx;
+    int16_t value;
+} ble_cmd_t;
+
+
+typedef int (ble_cmd_write_t) (const ble_cmd_t *cmd);
+/* For volume steps the value is the number of steps taken (or dropped on error) */
+typedef void (ble_cmd_status_callback_t) (const ble_cmd_t *cmd, int err, uint32_t rtt_us);
+
+
+int ble_cmd_init(ble_cmd_write_t *write);
+int ble_cmd_submit(const ble_cmd_t *cmd);
+void ble_cmd_batch_begin(void);
+void ble_cmd_batch_end(void);
+void ble_cmd_complete(uint8_t conn_idx, ble_cmd_type_t type, uint8_t inst_idx, int err);
+void ble_cmd_conn_hold(uint8_t conn_idx, bool hold);
+void ble_cmd_conn_reset(uint8_t conn_idx);
+
+void ble_cmd_status_cb_register(ble_cmd_status_callback_t *cmd_status_cb);
+
+#endif /* __BLE_CMD_H */
@@ -0,0 +1,275 @@
+/*
+ * Copyright (c) 2024 Demant A/S
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+/* Link policy
+ *
+ * Connections start out on a short connection interval, and the 2M PHY and
+ * the maximum data length are requested as soon as they are established.
+ * This keeps discovery and the write round trips of an active user short.
+ * Once a connection is ready and no command has been sent for a while, it is
+ * relaxed to a long interval with peripheral latency to save radio time. The
+ * next command switches it back to the fast parameters.
+ *
+ * A link counts as relaxed from the moment the controller reports the idle
+ * parameters applied, not from the request, so a command arriving while the
+ * update is still pending switches it back as soon as it takes effect.
+ *
+ * All link procedures are started from the system workqueue.
+ */
+
+#include <errno.h>
+#include <zephyr/kernel.h>
+#include <zephyr/sys/printk.h>
+#include <zephyr/bluetooth/bluetooth.h>
+#include <zephyr/bluetooth/conn.h>
+
+#include "ble_link.h"
+
+
+#define BLE_LINK_IDLE_PARAM     BT_LE_CONN_PARAM(CONFIG_BLE_LINK_IDLE_INTERVAL,     \
+                                                 CONFIG_BLE_LINK_IDLE_INTERVAL,     \
+                                                 CONFIG_BLE_LINK_IDLE_LATENCY,      \
+                                                 CONFIG_BLE_LINK_SUPERVISION_TIMEOUT)
+#define BLE_LINK_IDLE_TIMEOUT   K_MSEC(CONFIG_BLE_LINK_IDLE_TIMEOUT_MS)
+
+struct link {
+    struct bt_conn *conn;
+    struct k_work fast_work;
+    struct k_work_delayable idle_work;
+    bool ready;
+    /* Only changed from the system workqueue while connected */
+    bool negotiated;
+    /* Parameters in effect, as reported by the controller */
+    bool relaxed;
+};
+
+static struct link links[BLE_CONN_CNT];
+static struct k_spinlock link_lock;
+
+
+static struct bt_conn *link_conn_get(struct link *link)
+{
+    k_spinlock_key_t key = k_spin_lock(&link_lock);
+    struct bt_conn *conn = (link->conn != NULL) ? bt_conn_ref(link->conn) : NULL;
+    k_spin_unlock(&link_lock, key);
+
+    return conn;
+}
+
+static int link_to_idx(struct bt_conn *conn)
+{
+    for (int i = 0; i < BLE_CONN_CNT; i++) {
+        if (links[i].conn == conn) {
+            return i;
+        }
+    }
+
+    return -1;
+}
+
+static void link_negotiate(uint8_t conn_idx, struct bt_conn *conn)
+{
+    int err;
+
+#if defined(CONFIG_BT_USER_PHY_UPDATE)
+    err = bt_conn_le_phy_update(conn, BT_CONN_LE_PHY_PARAM_2M);
+    if (err) {
+        printk("Connection %d: PHY update failed (err %d)\n", conn_idx, err);
+    }
+#endif
+
+#if defined(CONFIG_BT_USER_DATA_LEN_UPDATE)
+    err = bt_conn_le_data_len_update(conn, BT_LE_DATA_LEN_PARAM_MAX);
+    if (err) {
+        printk("Connection %d: data length update failed (err %d)\n", conn_idx, err);
+    }
+#endif
+}
+
+static void link_fast_work_handler(struct k_work *work)
+{
+    struct link *link = CONTAINER_OF(work, struct link, fast_work);
+    uint8_t conn_idx = link - links;
+    struct bt_conn *conn = link_conn_get(link);
+
+    if (conn == NULL) {
+        return;
+    }
+
+    if (!link->negotiated) {
+        link->negotiated = true;
+        link_negotiate(conn_idx, conn);
+    }
+
+    if (link->relaxed) {
+        int err = bt_conn_le_param_update(conn, BLE_LINK_FAST_PARAM);
+        if (err) {
+            printk("Connection %d: fast parameters failed (err %d)\n", conn_idx, err);
+        }
+    }
+
+    bt_conn_unref(conn);
+}
+
+static void link_idle_work_handler(struct k_work *work)
+{
+    struct k_work_delayable *dwork = k_work_delayable_from_work(work);
+    struct link *link = CONTAINER_OF(dwork, struct link, idle_work);
+    uint8_t conn_idx = link - links;
+    struct bt_conn *conn = link_conn_get(link);
+
+    if (conn == NULL) {
+        return;
+    }
+
+    if (!link->relaxed) {
+        int err = bt_conn_le_param_update(conn, BLE_LINK_IDLE_PARAM);
+        if (err) {
+            printk("Connection %d: idle parameters failed (err %d)\n", conn_idx, err);
+        }
+    }
+
+    bt_conn_unref(conn);
+}
+
+void ble_link_connected(uint8_t conn_idx, struct bt_conn *conn)
+{
+    if (conn_idx >= BLE_CONN_CNT) {
+        return;
+    }
+
+    struct link *link = &links[conn_idx];
+    k_spinlock_key_t key = k_spin_lock(&link_lock);
+
+    if (link->conn != NULL) {
+        bt_conn_unref(link->conn);
+    }
+
+    link->conn = bt_conn_ref(conn);
+    link->ready = false;
+    link->negotiated = false;
+    link->relaxed = false;
+    k_spin_unlock(&link_lock, key);
+
+    k_work_submit(&link->fast_work);
+}
+
+void ble_link_ready(uint8_t conn_idx)
+{
+    if (conn_idx >= BLE_CONN_CNT) {
+        return;
+    }
+
+    links[conn_idx].ready = true;
+    k_work_reschedule(&links[conn_idx].idle_work, BLE_LINK_IDLE_TIMEOUT);
+}
+
+void ble_link_activity(uint8_t conn_idx)
+{
+    if ((conn_idx >= BLE_CONN_CNT) || !links[conn_idx].ready) {
+        return;
+    }
+
+    struct link *link = &links[conn_idx];
+
+    if (link->relaxed) {
+        k_work_submit(&link->fast_work);
+    }
+
+    k_work_reschedule(&link->idle_work, BLE_LINK_IDLE_TIMEOUT);
+}
+
+void ble_link_disconnected(uint8_t conn_idx)
+{
+    if (conn_idx >= BLE_CONN_CNT) {
+        return;
+    }
+
+    struct link *link = &links[conn_idx];
+
+    link->ready = false;
+    k_work_cancel(&link->fast_work);
+    k_work_cancel_delayable(&link->idle_work);
+
+    k_spinlock_key_t key = k_spin_lock(&link_lock);
+
+    if (link->conn != NULL) {
+        bt_conn_unref(link->conn);
+        link->conn = NULL;
+    }
+
+    k_spin_unlock(&link_lock, key);
+}
+
+static void le_param_updated(struct bt_conn *conn, uint16_t interval, uint16_t latency,
+                             uint16_t timeout)
+{
+    int conn_idx = link_to_idx(conn);
+
+    if (conn_idx == -1) {
+        return;
+    }
+
+    printk("Connection %d: interval %u.%02u ms, latency %u, timeout %u ms\n", conn_idx,
+           (interval * 125U) / 100U, (interval * 125U) % 100U, latency, timeout * 10U);
+
+    struct link *link = &links[conn_idx];
+
+    link->relaxed = (interval > CONFIG_BLE_LINK_FAST_INTERVAL) || (latency > 0);
+
+    /* Commands sent while the idle parameters were pending restarted the idle timer */
+    if (link->relaxed && link->ready && k_work_delayable_is_pending(&link->idle_work)) {
+        k_work_submit(&link->fast_work);
+    }
+}
+
+#if defined(CONFIG_BT_USER_PHY_UPDATE)
+static void le_phy_updated(struct bt_conn *conn, struct bt_conn_le_phy_info *param)
+{
+    int conn_idx = link_to_idx(conn);
+
+    if (conn_idx == -1) {
+        return;
+    }
+
+    printk("Connection %d: PHY tx %u, rx %u\n", conn_idx, param->tx_phy, param->rx_phy);
+}
+#endif
+
+#if defined(CONFIG_BT_USER_DATA_LEN_UPDATE)
+static void le_data_len_updated(struct bt_conn *conn, struct bt_conn_le_data_len_info *info)
+{
+    int conn_idx = link_to_idx(conn);
+
+    if (conn_idx == -1) {
+        return;
+    }
+
+    printk("Connection %d: data length tx %u, rx %u\n", conn_idx, info->tx_max_len,
+           info->rx_max_len);
+}
+#endif
+
+static struct bt_conn_cb link_callbacks = {
+    .le_param_updated = le_param_updated,
+#if defined(CONFIG_BT_USER_PHY_UPDATE)
+    .le_phy_updated = le_phy_updated,
+#endif
+#if defined(CONFIG_BT_USER_DATA_LEN_UPDATE)
+    .le_data_len_updated = le_data_len_updated,
+#endif
+};
+
+int ble_link_init(void)
+{
+    for (int i = 0; i < BLE_CONN_CNT; i++) {
+        k_work_init(&links[i].fast_work, link_fast_work_handler);
+        k_work_init_delayable(&links[i].idle_work, link_idle_work_handler);
+    }
+
+    bt_conn_cb_register(&link_callbacks);
+
+    return 0;
+}
@@ -0,0 +1,27 @@
+/*
+ * Copyright (c) 2024 Demant A/S
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+/* Header for the link policy */
+
+#ifndef __BLE_LINK_H
+#define __BLE_LINK_H
+
+#include <zephyr/bluetooth/conn.h>
+
+#include "ble.h"
+
+/* Connection parameters used while connecting, discovering and during user interaction */
+#define BLE_LINK_FAST_PARAM     BT_LE_CONN_PARAM(CONFIG_BLE_LINK_FAST_INTERVAL,     \
+                                                 CONFIG_BLE_LINK_FAST_INTERVAL,     \
+                                                 0, CONFIG_BLE_LINK_SUPERVISION_TIMEOUT)
+
+
+int ble_link_init(void);
+void ble_link_connected(uint8_t conn_idx, struct bt_conn *conn);
+void ble_link_ready(uint8_t conn_idx);
+void ble_link_activity(uint8_t conn_idx);
+void ble_link_disconnected(uint8_t conn_idx);
+
+#endif /* __BLE_LINK_H */
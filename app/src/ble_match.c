@@ -0,0 +1,298 @@
+/*
+ * Copyright (c) 2024 Demant A/S
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+/* Scan target matcher
+ *
+ * The target patterns are compiled once when scanning starts. A pattern is
+ * either an exact name, a name prefix ending with '*', or a lone '*' to match
+ * any device advertising the Volume Control Service. An empty or NULL pattern
+ * matches nothing. Once the SIRK of a coordinated set is known, reports carrying an RSI
+ * of that set are flagged as set members.
+ *
+ * Advertising reports are matched in place: the AD structures are walked
+ * without copying, a name is only hashed when its length fits a pattern, and
+ * only a matching hash is confirmed with a byte compare.
+ */
+
+#include <errno.h>
+#include <string.h>
+#include <zephyr/kernel.h>
+#include <zephyr/sys/byteorder.h>
+#include <zephyr/sys/printk.h>
+#include <zephyr/bluetooth/bluetooth.h>
+#include <zephyr/bluetooth/uuid.h>
+#include <zephyr/bluetooth/audio/csip.h>
+
+#include "ble_match.h"
+
+
+/* Longest name that can be matched, longer names never match an exact pattern */
+#define MATCH_NAME_LEN_MAX  (MAX_DEVICE_NAME_LEN - 1)
+
+/* Pattern matching any Volume Control Service advertiser, whatever its name */
+#define MATCH_ANY_VCS       "*"
+
+#define FNV_OFFSET          2166136261U
+#define FNV_PRIME           16777619U
+
+struct match_target {
+    const char *pattern;
+    uint32_t hash;
+    uint8_t len;
+    bool prefix;
+};
+
+static struct match_target match_targets[BLE_MATCH_MAX_TARGETS];
+static uint8_t match_target_cnt;
+
+/* Bit n is set when an exact or prefix pattern of length n exists */
+static uint32_t exact_len_mask;
+static uint32_t prefix_len_mask;
+static uint32_t uuid_targets;
+static uint32_t valid_targets;
+
+static ble_match_stats_t match_stats;
+
+#if defined(CONFIG_BLE_GROUP_CSIP)
+static uint8_t match_sirk[BT_CSIP_SIRK_SIZE];
+static uint32_t sirk_targets;
+#endif
+
+
+static inline uint32_t match_hash_step(uint32_t hash, uint8_t c)
+{
+    return (hash ^ c) * FNV_PRIME;
+}
+
+/* Bits 0 to len, without shifting a 32-bit value out of range */
+static inline uint32_t match_len_mask(uint8_t len)
+{
+    return (len >= 31) ? UINT32_MAX : BIT_MASK(len + 1);
+}
+
+int ble_match_build(const char *const *patterns, uint8_t cnt)
+{
+    if (cnt > BLE_MATCH_MAX_TARGETS) {
+        return -EINVAL;
+    }
+
+    exact_len_mask = 0;
+    prefix_len_mask = 0;
+    uuid_targets = 0;
+    valid_targets = 0;
+    match_target_cnt = 0;
+    memset(&match_stats, 0, sizeof(match_stats));
+
+    for (uint8_t i = 0; i < cnt; i++) {
+        struct match_target *target = &match_targets[i];
+
+        if ((patterns[i] == NULL) || (patterns[i][0] == '\0')) {
+            target->len = 0;
+            target->prefix = false;
+
+            if (patterns[i] != NULL) {
+                printk("Target %d: no device name configured\n", i);
+            }
+            continue;
+        }
+
+        size_t len = strlen(patterns[i]);
+
+        target->pattern = patterns[i];
+        target->prefix = (patterns[i][len - 1] == '*');
+        target->len = 0;
+        target->hash = FNV_OFFSET;
+
+        if (!strcmp(patterns[i], MATCH_ANY_VCS)) {
+            uuid_targets |= BIT(i);
+            valid_targets |= BIT(i);
+            continue;
+        }
+
+        if (target->prefix) {
+            len--;
+        }
+
+        if (len > MATCH_NAME_LEN_MAX) {
+            printk("Target %d: name pattern too long!\n", i);
+            continue;
+        }
+
+        target->len = len;
+
+        for (size_t j = 0; j < len; j++) {
+            target->hash = match_hash_step(target->hash, patterns[i][j]);
+        }
+
+        if (target->prefix) {
+            prefix_len_mask |= BIT(len);
+        } else {
+            exact_len_mask |= BIT(len);
+        }
+
+        valid_targets |= BIT(i);
+    }
+
+    match_target_cnt = cnt;
+
+    return 0;
+}
+
+static uint32_t match_len(const uint8_t *name, uint8_t len, uint32_t hash, bool prefix,
+                          uint32_t targets)
+{
+    uint32_t matched = 0;
+
+    for (uint8_t i = 0; i < match_target_cnt; i++) {
+        const struct match_target *target = &match_targets[i];
+
+        if ((targets & BIT(i)) && (target->prefix == prefix) && (target->len == len) &&
+            (target->hash == hash) && !memcmp(target->pattern, name, len)) {
+            matched |= BIT(i);
+        }
+    }
+
+    return matched;
+}
+
+static uint32_t match_name(const uint8_t *name, uint8_t name_len, uint32_t targets)
+{
+    uint32_t hash = FNV_OFFSET;
+    uint32_t matched = 0;
+    uint8_t max_len = MIN(name_len, MATCH_NAME_LEN_MAX);
+    uint32_t len_mask = prefix_len_mask & match_len_mask(max_len);
+    bool exact = (name_len <= MATCH_NAME_LEN_MAX) && (exact_len_mask & BIT(name_len));
+
+    if (!len_mask && !exact) {
+        return 0;
+    }
+
+    /* Hash only as far as the longest pattern that can match */
+    uint8_t hash_len = exact ? name_len : (find_msb_set(len_mask) - 1);
+
+    for (uint8_t len = 0; ; len++) {
+        if (len_mask & BIT(len)) {
+            matched |= match_len(name, len, hash, true, targets);
+        }
+
+        if (len == hash_len) {
+            break;
+        }
+
+        hash = match_hash_step(hash, name[len]);
+    }
+
+    if (exact) {
+        matched |= match_len(name, name_len, hash, false, targets);
+    }
+
+    return matched;
+}
+
+static bool match_uuid16(const uint8_t *data, uint8_t len, uint16_t uuid)
+{
+    for (uint8_t i = 0; (i + 1) < len; i += 2) {
+        if (sys_get_le16(&data[i]) == uuid) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+bool ble_match_report(const struct net_buf_simple *ad, uint32_t targets,
+                      ble_match_result_t *result)
+{
+    const uint8_t *data = ad->data;
+    uint16_t left = ad->len;
+    uint32_t matched = 0;
+    uint32_t set_targets = 0;
+
+    match_stats.reports++;
+
+    result->name = NULL;
+    result->name_len = 0;
+    result->set_member = false;
+
+#if defined(CONFIG_BLE_GROUP_CSIP)
+    set_targets = targets & sirk_targets;
+#endif
+    targets &= valid_targets;
+
+    /* Walk the AD structures in place: length, type, data */
+    while ((targets || set_targets) && (left > 1)) {
+        uint8_t len = data[0];
+        uint8_t type = data[1];
+
+        if ((len == 0) || (len >= left)) {
+            break;
+        }
+
+        switch (type) {
+        case BT_DATA_NAME_SHORTENED:
+        case BT_DATA_NAME_COMPLETE:
+            result->name = &data[2];
+            result->name_len = len - 1;
+            break;
+        case BT_DATA_UUID16_SOME:
+        case BT_DATA_UUID16_ALL:
+            if ((targets & uuid_targets) && match_uuid16(&data[2], len - 1, BT_UUID_VCS_VAL)) {
+                matched |= targets & uuid_targets;
+            }
+            break;
+#if defined(CONFIG_BLE_GROUP_CSIP)
+        case BT_DATA_CSIS_RSI:
+            if (set_targets) {
+                struct bt_data rsi = {
+                    .type = type,
+                    .data_len = len - 1,
+                    .data = &data[2],
+                };
+
+                /* Resolving the RSI costs an AES operation, it is only done when asked for */
+                result->set_member = bt_csip_set_coordinator_is_set_member(match_sirk, &rsi);
+            }
+            break;
+#endif
+        default:
+            break;
+        }
+
+        data += len + 1;
+        left -= len + 1;
+    }
+
+    if (result->name != NULL) {
+        matched |= match_name(result->name, result->name_len, targets);
+    }
+
+    if (!matched && !result->set_member) {
+        match_stats.rejected++;
+        return false;
+    }
+
+    result->targets = matched;
+    match_stats.accepted++;
+
+    return true;
+}
+
+#if defined(CONFIG_BLE_GROUP_CSIP)
+void ble_match_set_sirk(const uint8_t *sirk, uint32_t targets)
+{
+    if (sirk == NULL) {
+        sirk_targets = 0;
+        return;
+    }
+
+    memcpy(match_sirk, sirk, sizeof(match_sirk));
+    sirk_targets = targets;
+}
+#endif
+
+void ble_match_stats_get(ble_match_stats_t *stats)
+{
+    *stats = match_stats;
+}
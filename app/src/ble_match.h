@@ -0,0 +1,42 @@
+/*
+ * Copyright (c) 2024 Demant A/S
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+/* Header for the scan target matcher */
+
+#ifndef __BLE_MATCH_H
+#define __BLE_MATCH_H
+
+#include <zephyr/net/buf.h>
+
+#include "ble.h"
+
+#define BLE_MATCH_MAX_TARGETS   32
+
+
+typedef struct
+{
+    uint32_t reports;
+    uint32_t accepted;
+    uint32_t rejected;
+} ble_match_stats_t;
+
+typedef struct
+{
+    /* Bitmask of the matching targets */
+    uint32_t targets;
+    /* Advertised name, pointing into the advertising data and not terminated */
+    const uint8_t *name;
+    uint8_t name_len;
+    /* The advertiser carries an RSI of the known coordinated set */
+    bool set_member;
+} ble_match_result_t;
+
+
+int ble_match_build(const char *const *patterns, uint8_t cnt);
+bool ble_match_report(const struct net_buf_simple *ad, uint32_t targets, ble_match_result_t *result);
+void ble_match_set_sirk(const uint8_t *sirk, uint32_t targets);
+void ble_match_stats_get(ble_match_stats_t *stats);
+
+#endif /* __BLE_MATCH_H */
@@ -0,0 +1,140 @@
+/*
+ * Copyright (c) 2024 Demant A/S
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+/* Stack object registry
+ *
+ * Maps the objects the Bluetooth callbacks are given back to the connection
+ * and instance index in constant time. Connections are mapped through their
+ * stack index (bt_conn_index()). Volume controllers and VOCS/AICS instances
+ * are kept in an open addressing hash table with linear probing, filled when
+ * a connection is discovered and emptied when it is gone.
+ *
+ * The table has more than twice as many slots as objects, so probe sequences
+ * stay short and always end at an empty slot.
+ */
+
+#include <errno.h>
+#include <string.h>
+#include <zephyr/kernel.h>
+#include <zephyr/sys/printk.h>
+
+#include "ble_reg.h"
+
+
+#define REG_SLOTS           (2 * BLE_REG_OBJ_MAX + 1)
+
+struct reg_entry {
+    const void *obj;
+    uint8_t conn_idx;
+    uint8_t inst_idx;
+};
+
+/* Connection index plus one per stack connection, 0 when not ours */
+static uint8_t conn_map[CONFIG_BT_MAX_CONN];
+static struct reg_entry entries[REG_SLOTS];
+static uint16_t entry_cnt;
+
+static struct k_spinlock reg_lock;
+
+
+static uint32_t reg_slot(const void *obj)
+{
+    /* Objects are word aligned, Fibonacci hashing spreads the remaining bits */
+    return (((uint32_t)(uintptr_t)obj >> 2) * 2654435761U) % REG_SLOTS;
+}
+
+static struct reg_entry *reg_probe(const void *obj)
+{
+    uint32_t slot = reg_slot(obj);
+
+    while ((entries[slot].obj != NULL) && (entries[slot].obj != obj)) {
+        slot = (slot + 1) % REG_SLOTS;
+    }
+
+    return &entries[slot];
+}
+
+void ble_reg_conn_add(const struct bt_conn *conn, uint8_t conn_idx)
+{
+    conn_map[bt_conn_index(conn)] = conn_idx + 1;
+}
+
+/* Forgets the connection and every object registered for it */
+void ble_reg_conn_remove(const struct bt_conn *conn, uint8_t conn_idx)
+{
+    struct reg_entry kept[BLE_REG_OBJ_MAX];
+    uint16_t kept_cnt = 0;
+
+    if (conn != NULL) {
+        conn_map[bt_conn_index(conn)] = 0;
+    }
+
+    k_spinlock_key_t key = k_spin_lock(&reg_lock);
+
+    /* Removal would break the probe sequences, the table is rebuilt instead */
+    for (int i = 0; i < REG_SLOTS; i++) {
+        if ((entries[i].obj != NULL) && (entries[i].conn_idx != conn_idx)) {
+            kept[kept_cnt++] = entries[i];
+        }
+    }
+
+    memset(entries, 0, sizeof(entries));
+    entry_cnt = kept_cnt;
+
+    for (int i = 0; i < kept_cnt; i++) {
+        *reg_probe(kept[i].obj) = kept[i];
+    }
+
+    k_spin_unlock(&reg_lock, key);
+}
+
+int ble_reg_conn_idx(const struct bt_conn *conn)
+{
+    return (conn != NULL) ? (int)conn_map[bt_conn_index(conn)] - 1 : -1;
+}
+
+int ble_reg_obj_add(const void *obj, uint8_t conn_idx, uint8_t inst_idx)
+{
+    if (obj == NULL) {
+        return -EINVAL;
+    }
+
+    k_spinlock_key_t key = k_spin_lock(&reg_lock);
+    struct reg_entry *entry = reg_probe(obj);
+
+    if (entry->obj == NULL) {
+        if (entry_cnt >= BLE_REG_OBJ_MAX) {
+            k_spin_unlock(&reg_lock, key);
+            printk("Object registry full!\n");
+            return -ENOMEM;
+        }
+
+        entry_cnt++;
+    }
+
+    entry->obj = obj;
+    entry->conn_idx = conn_idx;
+    entry->inst_idx = inst_idx;
+
+    k_spin_unlock(&reg_lock, key);
+
+    return 0;
+}
+
+bool ble_reg_obj_find(const void *obj, uint8_t *conn_idx, uint8_t *inst_idx)
+{
+    k_spinlock_key_t key = k_spin_lock(&reg_lock);
+    const struct reg_entry *entry = reg_probe(obj);
+    bool found = (obj != NULL) && (entry->obj == obj);
+
+    if (found) {
+        *conn_idx = entry->conn_idx;
+        *inst_idx = entry->inst_idx;
+    }
+
+    k_spin_unlock(&reg_lock, key);
+
+    return found;
+}
@@ -0,0 +1,25 @@
+/*
+ * Copyright (c) 2024 Demant A/S
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+/* Header for the stack object registry */
+
+#ifndef __BLE_REG_H
+#define __BLE_REG_H
+
+#include <zephyr/bluetooth/conn.h>
+
+#include "ble.h"
+
+/* A volume controller and every VOCS and AICS instance of each connection */
+#define BLE_REG_OBJ_MAX     (BLE_CONN_CNT * (1 + VCP_MAX_VOCS_INST + VCP_MAX_AICS_INST))
+
+
+void ble_reg_conn_add(const struct bt_conn *conn, uint8_t conn_idx);
+void ble_reg_conn_remove(const struct bt_conn *conn, uint8_t conn_idx);
+int ble_reg_conn_idx(const struct bt_conn *conn);
+int ble_reg_obj_add(const void *obj, uint8_t conn_idx, uint8_t inst_idx);
+bool ble_reg_obj_find(const void *obj, uint8_t *conn_idx, uint8_t *inst_idx);
+
+#endif /* __BLE_REG_H */
@@ -0,0 +1,270 @@
+/*
+ * Copyright (c) 2024 Demant A/S
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+/* Scan result table
+ *
+ * Fixed-size, open-addressed table of the advertisers seen during a scan,
+ * keyed by address. The advertising data of an advertiser is matched once,
+ * or twice when the name only arrives in the scan response. Repeated reports
+ * then only update the smoothed RSSI and the time it was last seen.
+ *
+ * When several advertisers match the same target, the one with the strongest
+ * RSSI is picked. When the table is full, the entry seen longest ago is
+ * replaced, and entries that match no target are replaced first.
+ */
+
+#include <errno.h>
+#include <string.h>
+#include <zephyr/kernel.h>
+#include <zephyr/sys/printk.h>
+#include <zephyr/shell/shell.h>
+#include <zephyr/bluetooth/bluetooth.h>
+#include <zephyr/bluetooth/gap.h>
+
+#include "ble_scan.h"
+#include "ble_match.h"
+
+
+BUILD_ASSERT((BLE_SCAN_TABLE_SIZE & (BLE_SCAN_TABLE_SIZE - 1)) == 0,
+             "Scan table size must be a power of two");
+
+/* Slots searched for an address before the oldest one is replaced */
+#define SCAN_PROBE_MAX      MIN(8, BLE_SCAN_TABLE_SIZE)
+
+/* Smoothing factor of the RSSI: rssi += (new - rssi) / 4 */
+#define SCAN_RSSI_DIV       4
+
+struct scan_slot {
+    ble_scan_entry_t entry;
+    bool used;
+    /* Set once the advertising data that can carry the name has been matched */
+    bool resolved;
+};
+
+static struct scan_slot scan_slots[BLE_SCAN_TABLE_SIZE];
+static ble_scan_stats_t scan_stats;
+static struct k_spinlock scan_lock;
+
+
+static uint32_t scan_addr_hash(const bt_addr_le_t *addr)
+{
+    uint32_t hash = addr->type;
+
+    for (int i = 0; i < sizeof(addr->a.val); i++) {
+        hash = (hash * 31U) + addr->a.val[i];
+    }
+
+    /* Fibonacci hashing spreads the sequential addresses of a vendor */
+    return hash * 2654435761U;
+}
+
+/* Returns true when the older slot should be replaced before the newer one */
+static bool scan_slot_older(const struct scan_slot *slot, const struct scan_slot *than)
+{
+    if ((slot->entry.targets == 0) != (than->entry.targets == 0)) {
+        return (slot->entry.targets == 0);
+    }
+
+    return (int32_t)(slot->entry.last_seen_ms - than->entry.last_seen_ms) < 0;
+}
+
+static struct scan_slot *scan_slot_get(const bt_addr_le_t *addr, bool *found)
+{
+    uint32_t idx = scan_addr_hash(addr);
+    struct scan_slot *oldest = NULL;
+
+    *found = false;
+
+    for (int i = 0; i < SCAN_PROBE_MAX; i++) {
+        struct scan_slot *slot = &scan_slots[(idx + i) & (BLE_SCAN_TABLE_SIZE - 1)];
+
+        if (!slot->used) {
+            slot->used = true;
+            scan_stats.entries++;
+            return slot;
+        }
+
+        if (bt_addr_le_eq(&slot->entry.addr, addr)) {
+            *found = true;
+            return slot;
+        }
+
+        if ((oldest == NULL) || scan_slot_older(slot, oldest)) {
+            oldest = slot;
+        }
+    }
+
+    scan_stats.evicted++;
+
+    return oldest;
+}
+
+void ble_scan_table_reset(void)
+{
+    k_spinlock_key_t key = k_spin_lock(&scan_lock);
+    memset(scan_slots, 0, sizeof(scan_slots));
+    memset(&scan_stats, 0, sizeof(scan_stats));
+    k_spin_unlock(&scan_lock, key);
+}
+
+uint32_t ble_scan_table_update(const bt_addr_le_t *addr, int8_t rssi, uint8_t adv_type,
+                               struct net_buf_simple *ad, uint32_t targets)
+{
+    ble_match_result_t match;
+    uint32_t matched;
+    bool found;
+    k_spinlock_key_t key = k_spin_lock(&scan_lock);
+    struct scan_slot *slot = scan_slot_get(addr, &found);
+    ble_scan_entry_t *entry = &slot->entry;
+
+    scan_stats.reports++;
+
+    if (found) {
+        entry->rssi += (rssi - entry->rssi) / SCAN_RSSI_DIV;
+    } else {
+        memset(entry, 0, sizeof(*entry));
+        bt_addr_le_copy(&entry->addr, addr);
+        entry->rssi = rssi;
+        slot->resolved = false;
+    }
+
+    entry->last_seen_ms = k_uptime_get_32();
+
+    if (slot->resolved) {
+        scan_stats.cached++;
+        matched = entry->targets & targets;
+        k_spin_unlock(&scan_lock, key);
+        return matched;
+    }
+
+    /* Match against every target, so the result stays valid when the wanted targets change */
+    if (ble_match_report(ad, UINT32_MAX, &match)) {
+        entry->targets |= match.targets;
+    }
+
+    if (match.name != NULL) {
+        uint8_t len = MIN(match.name_len, sizeof(entry->name) - 1);
+
+        memcpy(entry->name, match.name, len);
+        entry->name[len] = '\0';
+    }
+
+    /* Scannable advertisers may carry the name in the scan response only */
+    slot->resolved = (match.name != NULL) || (adv_type == BT_GAP_ADV_TYPE_SCAN_RSP) ||
+                     (adv_type == BT_GAP_ADV_TYPE_ADV_DIRECT_IND) ||
+                     (adv_type == BT_GAP_ADV_TYPE_ADV_NONCONN_IND);
+
+    matched = entry->targets & targets;
+    k_spin_unlock(&scan_lock, key);
+
+    return matched;
+}
+
+int ble_scan_table_best(uint8_t target, ble_scan_entry_t *entry)
+{
+    const ble_scan_entry_t *best = NULL;
+    int cnt = 0;
+    k_spinlock_key_t key = k_spin_lock(&scan_lock);
+
+    for (int i = 0; i < BLE_SCAN_TABLE_SIZE; i++) {
+        const struct scan_slot *slot = &scan_slots[i];
+
+        if (!slot->used || !(slot->entry.targets & BIT(target))) {
+            continue;
+        }
+
+        cnt++;
+
+        if ((best == NULL) || (slot->entry.rssi > best->rssi)) {
+            best = &slot->entry;
+        }
+    }
+
+    if (best != NULL) {
+        *entry = *best;
+    }
+
+    k_spin_unlock(&scan_lock, key);
+
+    return cnt;
+}
+
+int ble_scan_table_get(ble_scan_entry_t *entries, int max)
+{
+    int cnt = 0;
+    k_spinlock_key_t key = k_spin_lock(&scan_lock);
+
+    /* Keep the strongest matching advertisers, sorted by RSSI */
+    for (int i = 0; i < BLE_SCAN_TABLE_SIZE; i++) {
+        const struct scan_slot *slot = &scan_slots[i];
+        int pos;
+
+        if (!slot->used || (slot->entry.targets == 0)) {
+            continue;
+        }
+
+        for (pos = cnt; (pos > 0) && (entries[pos - 1].rssi < slot->entry.rssi); pos--) {
+            if (pos < max) {
+                entries[pos] = entries[pos - 1];
+            }
+        }
+
+        if (pos < max) {
+            entries[pos] = slot->entry;
+            cnt = MIN(cnt + 1, max);
+        }
+    }
+
+    k_spin_unlock(&scan_lock, key);
+
+    return cnt;
+}
+
+void ble_scan_stats_get(ble_scan_stats_t *stats)
+{
+    k_spinlock_key_t key = k_spin_lock(&scan_lock);
+    *stats = scan_stats;
+    k_spin_unlock(&scan_lock, key);
+}
+
+#if defined(CONFIG_SHELL)
+static int cmd_scan_shell(const struct shell *sh, size_t argc, char **argv)
+{
+    uint32_t now = k_uptime_get_32();
+    ble_match_stats_t match_stats;
+    ble_scan_stats_t stats;
+
+    for (int i = 0; i < BLE_SCAN_TABLE_SIZE; i++) {
+        char addr_str[BT_ADDR_LE_STR_LEN];
+        ble_scan_entry_t entry;
+        bool used;
+
+        k_spinlock_key_t key = k_spin_lock(&scan_lock);
+        used = scan_slots[i].used;
+        entry = scan_slots[i].entry;
+        k_spin_unlock(&scan_lock, key);
+
+        if (!used) {
+            continue;
+        }
+
+        bt_addr_le_to_str(&entry.addr, addr_str, sizeof(addr_str));
+        shell_print(sh, "%s %4d dBm %6u ms ago targets 0x%02x %s", addr_str, entry.rssi,
+                    now - entry.last_seen_ms, entry.targets, entry.name);
+    }
+
+    ble_scan_stats_get(&stats);
+    ble_match_stats_get(&match_stats);
+
+    shell_print(sh, "%u entries, %u reports, %u cached, %u evicted", stats.entries,
+                stats.reports, stats.cached, stats.evicted);
+    shell_print(sh, "Matcher: %u reports, %u accepted, %u rejected", match_stats.reports,
+                match_stats.accepted, match_stats.rejected);
+
+    return 0;
+}
+
+SHELL_SUBCMD_ADD((vcpc), scan, NULL, "Show the scan result table", cmd_scan_shell, 1, 0);
+#endif
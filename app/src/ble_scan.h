@@ -0,0 +1,46 @@
+/*
+ * Copyright (c) 2024 Demant A/S
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+/* Header for the scan result table */
+
+#ifndef __BLE_SCAN_H
+#define __BLE_SCAN_H
+
+#include <zephyr/bluetooth/bluetooth.h>
+#include <zephyr/net/buf.h>
+
+#include "ble.h"
+
+#define BLE_SCAN_TABLE_SIZE     CONFIG_BLE_SCAN_TABLE_SIZE
+
+
+typedef struct
+{
+    bt_addr_le_t addr;
+    /* Smoothed RSSI of the advertiser */
+    int8_t rssi;
+    uint32_t last_seen_ms;
+    /* Bitmask of the targets the advertiser matches */
+    uint32_t targets;
+    char name[MAX_DEVICE_NAME_LEN];
+} ble_scan_entry_t;
+
+typedef struct
+{
+    uint32_t reports;
+    uint32_t cached;
+    uint32_t evicted;
+    uint16_t entries;
+} ble_scan_stats_t;
+
+
+void ble_scan_table_reset(void);
+uint32_t ble_scan_table_update(const bt_addr_le_t *addr, int8_t rssi, uint8_t adv_type,
+                               struct net_buf_simple *ad, uint32_t targets);
+int ble_scan_table_best(uint8_t target, ble_scan_entry_t *entry);
+int ble_scan_table_get(ble_scan_entry_t *entries, int max);
+void ble_scan_stats_get(ble_scan_stats_t *stats);
+
+#endif /* __BLE_SCAN_H */
@@ -0,0 +1,116 @@
+/*
+ * Copyright (c) 2024 Demant A/S
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+/* Coordinated set membership
+ *
+ * The Coordinated Set Identification Service of the first connected device
+ * tells the size of its set and the Set Identity Resolving Key (SIRK). The
+ * SIRK lets the scanner recognize the other members of the set by the
+ * Resolvable Set Identifier (RSI) in their advertising data, so that the
+ * group is formed from the set instead of from configured names.
+ */
+
+#include <errno.h>
+#include <string.h>
+#include <zephyr/kernel.h>
+#include <zephyr/sys/printk.h>
+#include <zephyr/bluetooth/conn.h>
+#include <zephyr/bluetooth/audio/csip.h>
+
+#include "ble_set.h"
+
+#if defined(CONFIG_BLE_GROUP_CSIP)
+
+static struct bt_conn *set_conn[BLE_CONN_CNT];
+static uint8_t set_sirk[BT_CSIP_SIRK_SIZE];
+static bool set_sirk_valid;
+
+static ble_set_callback_t *user_set_cb = NULL;
+
+
+static int set_conn_to_idx(const struct bt_conn *conn)
+{
+    for (int i = 0; i < BLE_CONN_CNT; i++) {
+        if (conn == set_conn[i]) {
+            return i;
+        }
+    }
+
+    return -1;
+}
+
+static void csip_discover_cb(struct bt_conn *conn,
+                             const struct bt_csip_set_coordinator_set_member *member,
+                             int err, size_t set_count)
+{
+    const struct bt_csip_set_coordinator_set_info *info;
+    int conn_idx = set_conn_to_idx(conn);
+
+    if (conn_idx == -1) {
+        return;
+    }
+
+    set_conn[conn_idx] = NULL;
+
+    if (!err && (set_count == 0)) {
+        err = -ENOENT;
+    }
+
+    if (err) {
+        printk("Connection %d: not a coordinated set member (err %d)\n", conn_idx, err);
+        user_set_cb(conn_idx, err, 0, 0);
+        return;
+    }
+
+    info = &member->insts[0].info;
+
+    if (!set_sirk_valid) {
+        memcpy(set_sirk, info->sirk, sizeof(set_sirk));
+        set_sirk_valid = true;
+    } else if (memcmp(set_sirk, info->sirk, sizeof(set_sirk))) {
+        printk("Connection %d: member of another set!\n", conn_idx);
+        user_set_cb(conn_idx, -EINVAL, 0, 0);
+        return;
+    }
+
+    printk("Connection %d: rank %u in a set of %u\n", conn_idx, info->rank, info->set_size);
+    user_set_cb(conn_idx, 0, info->set_size, info->rank);
+}
+
+static struct bt_csip_set_coordinator_cb csip_callbacks = {
+    .discover = csip_discover_cb,
+};
+
+int ble_set_init(ble_set_callback_t *cb)
+{
+    user_set_cb = cb;
+
+    return bt_csip_set_coordinator_register_cb(&csip_callbacks);
+}
+
+int ble_set_discover(uint8_t conn_idx, struct bt_conn *conn)
+{
+    if (conn_idx >= BLE_CONN_CNT) {
+        return -EINVAL;
+    }
+
+    set_conn[conn_idx] = conn;
+
+    int err = bt_csip_set_coordinator_discover(conn);
+    if (err) {
+        set_conn[conn_idx] = NULL;
+        printk("Connection %d: CSIP discovery failed (err %d)\n", conn_idx, err);
+        return err;
+    }
+
+    return 0;
+}
+
+const uint8_t *ble_set_sirk(void)
+{
+    return set_sirk_valid ? set_sirk : NULL;
+}
+
+#endif /* CONFIG_BLE_GROUP_CSIP */
@@ -0,0 +1,23 @@
+/*
+ * Copyright (c) 2024 Demant A/S
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+/* Header for the coordinated set membership */
+
+#ifndef __BLE_SET_H
+#define __BLE_SET_H
+
+#include <zephyr/bluetooth/conn.h>
+
+#include "ble.h"
+
+
+typedef void (ble_set_callback_t) (uint8_t conn_idx, int err, uint8_t set_size, uint8_t rank);
+
+
+int ble_set_init(ble_set_callback_t *cb);
+int ble_set_discover(uint8_t conn_idx, struct bt_conn *conn);
+const uint8_t *ble_set_sirk(void);
+
+#endif /* __BLE_SET_H */
@@ -0,0 +1,564 @@
+/*
+ * Copyright (c) 2024 Demant A/S
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+/* VOCS/AICS notification subscriptions
+ *
+ * The volume controller subscribes to every characteristic of every VOCS and
+ * AICS instance during discovery, and has no way to unsubscribe a single
+ * instance. Each change of an instance nobody looks at then still costs a
+ * notification on air and a pass through the state callbacks.
+ *
+ * Once a connection is ready, the CCC descriptors of its instances are
+ * discovered here. The services included by VCS are walked in the order the
+ * volume controller numbers its instances, and the CCCs within each of them
+ * are collected. Notifications of an instance are switched off by writing 0
+ * to its CCCs and back on by writing the notification bit. The volume
+ * controller's subscriptions stay registered in the host throughout, so the
+ * notifications reach it again as soon as they are back on. The host's own
+ * unsubscribe could not be used for this: it only clears a CCC once the last
+ * subscriber of the handle is gone, and the volume controller never goes.
+ *
+ * An instance is kept on while the UI wants it, and for CONFIG_BLE_SUBS_HOLD_MS
+ * after each write to it so that the group gets the echo of the write. An
+ * instance switched back on is resynced through the resync callback, as its
+ * changes were not notified meanwhile.
+ *
+ * All GATT procedures are started from the system workqueue, one at a time
+ * per connection.
+ */
+
+#include <errno.h>
+#include <string.h>
+#include <zephyr/kernel.h>
+#include <zephyr/sys/printk.h>
+#include <zephyr/shell/shell.h>
+#include <zephyr/bluetooth/bluetooth.h>
+#include <zephyr/bluetooth/conn.h>
+#include <zephyr/bluetooth/gatt.h>
+#include <zephyr/bluetooth/uuid.h>
+
+#include "ble_subs.h"
+
+
+#define SUBS_HOLD_TIMEOUT   K_MSEC(CONFIG_BLE_SUBS_HOLD_MS)
+/* State, status or location, and description of an instance */
+#define SUBS_CCC_MAX        3
+/* Every VOCS, then every AICS instance */
+#define SUBS_INST_CNT       (VCP_MAX_VOCS_INST + VCP_MAX_AICS_INST)
+
+BUILD_ASSERT(SUBS_INST_CNT <= 32, "Instance masks hold up to 32 instances");
+
+typedef enum
+{
+    subs_idle = 0,
+    subs_vcs,
+    subs_include,
+    subs_ccc,
+    subs_done,
+    /* The instances could not be matched, notifications stay as the volume controller set them */
+    subs_failed,
+} subs_stage_t;
+
+struct subs_inst {
+    uint16_t start_handle;
+    uint16_t end_handle;
+    uint16_t ccc_handle[SUBS_CCC_MAX];
+    uint8_t ccc_cnt;
+};
+
+struct subs_conn {
+    struct bt_conn *conn;
+    struct k_work work;
+    struct k_work_delayable hold_work;
+    subs_stage_t stage;
+    /* A GATT procedure of the connection is running */
+    bool busy;
+    uint8_t vocs_cnt;
+    uint8_t aics_cnt;
+    uint8_t vocs_found;
+    uint8_t aics_found;
+    uint16_t vcs_start_handle;
+    uint16_t vcs_end_handle;
+    struct subs_inst inst[SUBS_INST_CNT];
+    /* Instances whose CCCs are known and can be switched */
+    uint32_t managed;
+    /* Instances wanted by the UI, written recently, and with notifications on */
+    uint32_t wanted;
+    uint32_t held;
+    uint32_t on;
+    /* Instance being discovered or switched, and its next CCC */
+    uint8_t cur;
+    uint8_t cur_ccc;
+    uint16_t ccc_value;
+    struct bt_gatt_discover_params disc_params;
+    struct bt_gatt_write_params write_params;
+    uint32_t ccc_writes;
+    uint32_t resyncs;
+};
+
+static struct subs_conn subs_conns[BLE_CONN_CNT];
+static struct k_spinlock subs_lock;
+
+static ble_subs_resync_t *user_resync = NULL;
+
+
+static int subs_inst_bit(vcp_type_t type, uint8_t inst_idx)
+{
+    switch (type) {
+    case vcp_vocs_state:
+        return (inst_idx < VCP_MAX_VOCS_INST) ? inst_idx : -1;
+    case vcp_aics_state:
+        return (inst_idx < VCP_MAX_AICS_INST) ? (VCP_MAX_VOCS_INST + inst_idx) : -1;
+    default:
+        return -1;
+    }
+}
+
+static struct bt_conn *subs_conn_get(struct subs_conn *sc)
+{
+    k_spinlock_key_t key = k_spin_lock(&subs_lock);
+    struct bt_conn *conn = (sc->conn != NULL) ? bt_conn_ref(sc->conn) : NULL;
+    k_spin_unlock(&subs_lock, key);
+
+    return conn;
+}
+
+/* Callbacks of a procedure started on a connection that is gone are ignored */
+static bool subs_conn_is(struct subs_conn *sc, struct bt_conn *conn)
+{
+    k_spinlock_key_t key = k_spin_lock(&subs_lock);
+    bool is = (sc->conn == conn);
+    k_spin_unlock(&subs_lock, key);
+
+    return is;
+}
+
+static void subs_include_add(struct subs_conn *sc, const struct bt_gatt_include *inc)
+{
+    int bit = -1;
+
+    if (inc->uuid == NULL) {
+        return;
+    }
+
+    /* Numbered like the volume controller does, which also stops at the maximum */
+    if (!bt_uuid_cmp(inc->uuid, BT_UUID_VOCS) && (sc->vocs_found < VCP_MAX_VOCS_INST)) {
+        bit = subs_inst_bit(vcp_vocs_state, sc->vocs_found++);
+    } else if (!bt_uuid_cmp(inc->uuid, BT_UUID_AICS) && (sc->aics_found < VCP_MAX_AICS_INST)) {
+        bit = subs_inst_bit(vcp_aics_state, sc->aics_found++);
+    }
+
+    if (bit < 0) {
+        return;
+    }
+
+    sc->inst[bit].start_handle = inc->start_handle;
+    sc->inst[bit].end_handle = inc->end_handle;
+}
+
+static uint8_t subs_discover_cb(struct bt_conn *conn, const struct bt_gatt_attr *attr,
+                                struct bt_gatt_discover_params *params)
+{
+    struct subs_conn *sc = CONTAINER_OF(params, struct subs_conn, disc_params);
+    uint8_t conn_idx = sc - subs_conns;
+
+    if (!subs_conn_is(sc, conn)) {
+        return BT_GATT_ITER_STOP;
+    }
+
+    switch (sc->stage) {
+    case subs_vcs:
+        if (attr == NULL) {
+            printk("Connection %d: VCS not found for the subscriptions\n", conn_idx);
+            sc->stage = subs_failed;
+            break;
+        }
+
+        const struct bt_gatt_service_val *svc = attr->user_data;
+
+        sc->vcs_start_handle = attr->handle + 1;
+        sc->vcs_end_handle = svc->end_handle;
+        sc->stage = subs_include;
+        break;
+    case subs_include:
+        if (attr != NULL) {
+            subs_include_add(sc, attr->user_data);
+            return BT_GATT_ITER_CONTINUE;
+        }
+
+        if ((sc->vocs_found != sc->vocs_cnt) || (sc->aics_found != sc->aics_cnt)) {
+            printk("Connection %d: %u VOCS and %u AICS included, %u and %u discovered\n",
+                   conn_idx, sc->vocs_found, sc->aics_found, sc->vocs_cnt, sc->aics_cnt);
+            sc->stage = subs_failed;
+            break;
+        }
+
+        sc->cur = 0;
+        sc->stage = subs_ccc;
+        break;
+    case subs_ccc:
+        struct subs_inst *inst = &sc->inst[sc->cur];
+
+        if (attr != NULL) {
+            if (inst->ccc_cnt < SUBS_CCC_MAX) {
+                inst->ccc_handle[inst->ccc_cnt++] = attr->handle;
+            }
+
+            return BT_GATT_ITER_CONTINUE;
+        }
+
+        if (inst->ccc_cnt > 0) {
+            k_spinlock_key_t key = k_spin_lock(&subs_lock);
+            sc->managed |= BIT(sc->cur);
+            k_spin_unlock(&subs_lock, key);
+        }
+
+        sc->cur++;
+        break;
+    default:
+        return BT_GATT_ITER_STOP;
+    }
+
+    sc->busy = false;
+    k_work_submit(&sc->work);
+
+    return BT_GATT_ITER_STOP;
+}
+
+static void subs_write_cb(struct bt_conn *conn, uint8_t err, struct bt_gatt_write_params *params)
+{
+    struct subs_conn *sc = CONTAINER_OF(params, struct subs_conn, write_params);
+    uint8_t conn_idx = sc - subs_conns;
+    struct subs_inst *inst = &sc->inst[sc->cur];
+    bool resync = false;
+
+    if (!subs_conn_is(sc, conn)) {
+        return;
+    }
+
+    k_spinlock_key_t key = k_spin_lock(&subs_lock);
+
+    if (err) {
+        /* Left as it is, the instance is not switched again on this connection */
+        sc->managed &= ~BIT(sc->cur);
+        sc->cur_ccc = 0;
+    } else {
+        sc->ccc_writes++;
+
+        if (++sc->cur_ccc == inst->ccc_cnt) {
+            sc->on ^= BIT(sc->cur);
+            sc->cur_ccc = 0;
+            resync = (sc->ccc_value != 0);
+            sc->resyncs += resync;
+        }
+    }
+
+    sc->busy = false;
+    k_spin_unlock(&subs_lock, key);
+
+    if (err) {
+        printk("Connection %d: CCC 0x%04x write failed (err %u)\n", conn_idx, params->handle,
+               err);
+    }
+
+    if (resync && (user_resync != NULL)) {
+        if (sc->cur < VCP_MAX_VOCS_INST) {
+            user_resync(conn_idx, vcp_vocs_state, sc->cur);
+        } else {
+            user_resync(conn_idx, vcp_aics_state, sc->cur - VCP_MAX_VOCS_INST);
+        }
+    }
+
+    k_work_submit(&sc->work);
+}
+
+/* Next step of the CCC discovery, false once every instance has been visited */
+static bool subs_discover_next(struct subs_conn *sc)
+{
+    struct bt_gatt_discover_params *params = &sc->disc_params;
+
+    params->func = subs_discover_cb;
+
+    switch (sc->stage) {
+    case subs_vcs:
+        params->uuid = BT_UUID_VCS;
+        params->type = BT_GATT_DISCOVER_PRIMARY;
+        params->start_handle = BT_ATT_FIRST_ATTRIBUTE_HANDLE;
+        params->end_handle = BT_ATT_LAST_ATTRIBUTE_HANDLE;
+        return true;
+    case subs_include:
+        params->uuid = NULL;
+        params->type = BT_GATT_DISCOVER_INCLUDE;
+        params->start_handle = sc->vcs_start_handle;
+        params->end_handle = sc->vcs_end_handle;
+        return true;
+    case subs_ccc:
+        while ((sc->cur < SUBS_INST_CNT) && (sc->inst[sc->cur].start_handle == 0)) {
+            sc->cur++;
+        }
+
+        if (sc->cur == SUBS_INST_CNT) {
+            return false;
+        }
+
+        params->uuid = BT_UUID_GATT_CCC;
+        params->type = BT_GATT_DISCOVER_DESCRIPTOR;
+        params->start_handle = sc->inst[sc->cur].start_handle;
+        params->end_handle = sc->inst[sc->cur].end_handle;
+        return true;
+    default:
+        return false;
+    }
+}
+
+/* Next CCC write bringing an instance to its wanted state, false when all are there */
+static bool subs_switch_next(struct subs_conn *sc)
+{
+    if (sc->cur_ccc == 0) {
+        uint32_t diff = (sc->wanted | sc->held) ^ sc->on;
+
+        diff &= sc->managed;
+
+        if (diff == 0) {
+            return false;
+        }
+
+        sc->cur = find_lsb_set(diff) - 1;
+        sc->ccc_value = (sc->on & BIT(sc->cur)) ? 0 : BT_GATT_CCC_NOTIFY;
+    }
+
+    sc->write_params.func = subs_write_cb;
+    sc->write_params.handle = sc->inst[sc->cur].ccc_handle[sc->cur_ccc];
+    sc->write_params.offset = 0;
+    sc->write_params.data = &sc->ccc_value;
+    sc->write_params.length = sizeof(sc->ccc_value);
+
+    return true;
+}
+
+static void subs_work_handler(struct k_work *work)
+{
+    struct subs_conn *sc = CONTAINER_OF(work, struct subs_conn, work);
+    uint8_t conn_idx = sc - subs_conns;
+    struct bt_conn *conn = subs_conn_get(sc);
+    bool discover = false;
+    bool write = false;
+    int err = 0;
+
+    if (conn == NULL) {
+        return;
+    }
+
+    k_spinlock_key_t key = k_spin_lock(&subs_lock);
+
+    if (!sc->busy) {
+        discover = subs_discover_next(sc);
+
+        if (!discover && (sc->stage == subs_ccc)) {
+            sc->stage = subs_done;
+        }
+
+        write = !discover && (sc->stage == subs_done) && subs_switch_next(sc);
+        sc->busy = discover || write;
+    }
+
+    k_spin_unlock(&subs_lock, key);
+
+    if (discover) {
+        err = bt_gatt_discover(conn, &sc->disc_params);
+    } else if (write) {
+        err = bt_gatt_write(conn, &sc->write_params);
+    }
+
+    if (err) {
+        printk("Connection %d: subscription %s failed (err %d)\n", conn_idx,
+               discover ? "discovery" : "write", err);
+
+        key = k_spin_lock(&subs_lock);
+
+        if (discover) {
+            sc->stage = subs_failed;
+        } else {
+            sc->managed &= ~BIT(sc->cur);
+            sc->cur_ccc = 0;
+        }
+
+        sc->busy = false;
+        k_spin_unlock(&subs_lock, key);
+
+        if (write) {
+            k_work_submit(&sc->work);
+        }
+    }
+
+    bt_conn_unref(conn);
+}
+
+static void subs_hold_work_handler(struct k_work *work)
+{
+    struct k_work_delayable *dwork = k_work_delayable_from_work(work);
+    struct subs_conn *sc = CONTAINER_OF(dwork, struct subs_conn, hold_work);
+
+    k_spinlock_key_t key = k_spin_lock(&subs_lock);
+    sc->held = 0;
+    k_spin_unlock(&subs_lock, key);
+
+    k_work_submit(&sc->work);
+}
+
+int ble_subs_init(ble_subs_resync_t *resync)
+{
+    user_resync = resync;
+
+    for (int i = 0; i < BLE_CONN_CNT; i++) {
+        k_work_init(&subs_conns[i].work, subs_work_handler);
+        k_work_init_delayable(&subs_conns[i].hold_work, subs_hold_work_handler);
+
+        /* Until the UI tells otherwise, everything the volume controller subscribed stays */
+        subs_conns[i].wanted = BIT_MASK(SUBS_INST_CNT);
+    }
+
+    return 0;
+}
+
+void ble_subs_ready(uint8_t conn_idx, struct bt_conn *conn, uint8_t vocs_count,
+                    uint8_t aics_count)
+{
+    if (conn_idx >= BLE_CONN_CNT) {
+        return;
+    }
+
+    struct subs_conn *sc = &subs_conns[conn_idx];
+    k_spinlock_key_t key = k_spin_lock(&subs_lock);
+
+    if (sc->conn != NULL) {
+        bt_conn_unref(sc->conn);
+    }
+
+    sc->conn = bt_conn_ref(conn);
+    sc->stage = subs_vcs;
+    sc->busy = false;
+    sc->vocs_cnt = vocs_count;
+    sc->aics_cnt = aics_count;
+    sc->vocs_found = 0;
+    sc->aics_found = 0;
+    memset(sc->inst, 0, sizeof(sc->inst));
+    sc->managed = 0;
+    sc->on = BIT_MASK(SUBS_INST_CNT);
+    sc->cur = 0;
+    sc->cur_ccc = 0;
+    k_spin_unlock(&subs_lock, key);
+
+    k_work_submit(&sc->work);
+}
+
+void ble_subs_disconnected(uint8_t conn_idx)
+{
+    if (conn_idx >= BLE_CONN_CNT) {
+        return;
+    }
+
+    struct subs_conn *sc = &subs_conns[conn_idx];
+
+    k_work_cancel(&sc->work);
+    k_work_cancel_delayable(&sc->hold_work);
+
+    k_spinlock_key_t key = k_spin_lock(&subs_lock);
+
+    if (sc->conn != NULL) {
+        bt_conn_unref(sc->conn);
+        sc->conn = NULL;
+    }
+
+    sc->stage = subs_idle;
+    sc->busy = false;
+    sc->managed = 0;
+    sc->held = 0;
+    k_spin_unlock(&subs_lock, key);
+}
+
+int ble_subs_set(uint8_t conn_idx, vcp_type_t type, uint8_t inst_idx, bool subscribe)
+{
+    int bit = subs_inst_bit(type, inst_idx);
+
+    if ((conn_idx >= BLE_CONN_CNT) || (bit < 0)) {
+        return -EINVAL;
+    }
+
+    struct subs_conn *sc = &subs_conns[conn_idx];
+    k_spinlock_key_t key = k_spin_lock(&subs_lock);
+    bool changed = (subscribe != ((sc->wanted & BIT(bit)) != 0));
+
+    WRITE_BIT(sc->wanted, bit, subscribe);
+    k_spin_unlock(&subs_lock, key);
+
+    if (changed) {
+        k_work_submit(&sc->work);
+    }
+
+    return 0;
+}
+
+void ble_subs_hold(uint8_t conn_idx, vcp_type_t type, uint8_t inst_idx)
+{
+    int bit = subs_inst_bit(type, inst_idx);
+
+    if ((conn_idx >= BLE_CONN_CNT) || (bit < 0)) {
+        return;
+    }
+
+    struct subs_conn *sc = &subs_conns[conn_idx];
+    k_spinlock_key_t key = k_spin_lock(&subs_lock);
+    bool changed = !(sc->held & BIT(bit));
+
+    sc->held |= BIT(bit);
+    k_spin_unlock(&subs_lock, key);
+
+    k_work_reschedule(&sc->hold_work, SUBS_HOLD_TIMEOUT);
+
+    if (changed) {
+        k_work_submit(&sc->work);
+    }
+}
+
+#if defined(CONFIG_SHELL)
+static int subs_shell(const struct shell *sh, size_t argc, char **argv)
+{
+    static const char *const stage_name[] = {
+        [subs_idle] = "idle",
+        [subs_vcs] = "discovering",
+        [subs_include] = "discovering",
+        [subs_ccc] = "discovering",
+        [subs_done] = "managed",
+        [subs_failed] = "not managed",
+    };
+
+    for (uint8_t i = 0; i < BLE_CONN_CNT; i++) {
+        struct subs_conn *sc = &subs_conns[i];
+
+        if (sc->conn == NULL) {
+            continue;
+        }
+
+        k_spinlock_key_t key = k_spin_lock(&subs_lock);
+        subs_stage_t stage = sc->stage;
+        uint32_t on = sc->on;
+        uint32_t managed = sc->managed;
+        uint32_t ccc_writes = sc->ccc_writes;
+        uint32_t resyncs = sc->resyncs;
+        k_spin_unlock(&subs_lock, key);
+
+        shell_print(sh, "Connection %d: %s, notified VOCS 0x%02x of 0x%02x, AICS 0x%02x of 0x%02x, "
+                    "%u CCC write(s), %u resync(s)", i, stage_name[stage],
+                    on & BIT_MASK(VCP_MAX_VOCS_INST), managed & BIT_MASK(VCP_MAX_VOCS_INST),
+                    on >> VCP_MAX_VOCS_INST, managed >> VCP_MAX_VOCS_INST, ccc_writes, resyncs);
+    }
+
+    return 0;
+}
+
+SHELL_SUBCMD_ADD((vcpc), subs, NULL, "Show the VOCS and AICS notification subscriptions",
+                 subs_shell, 1, 0);
+#endif
@@ -0,0 +1,27 @@
+/*
+ * Copyright (c) 2024 Demant A/S
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+/* Header for the VOCS/AICS notification subscriptions */
+
+#ifndef __BLE_SUBS_H
+#define __BLE_SUBS_H
+
+#include <zephyr/bluetooth/conn.h>
+
+#include "ble.h"
+
+
+/* Called when notifications of an instance are switched back on, changes may have been missed */
+typedef void (ble_subs_resync_t) (uint8_t conn_idx, vcp_type_t type, uint8_t inst_idx);
+
+
+int ble_subs_init(ble_subs_resync_t *resync);
+void ble_subs_ready(uint8_t conn_idx, struct bt_conn *conn, uint8_t vocs_count,
+                    uint8_t aics_count);
+void ble_subs_disconnected(uint8_t conn_idx);
+int ble_subs_set(uint8_t conn_idx, vcp_type_t type, uint8_t inst_idx, bool subscribe);
+void ble_subs_hold(uint8_t conn_idx, vcp_type_t type, uint8_t inst_idx);
+
+#endif /* __BLE_SUBS_H */
@@ -0,0 +1,908 @@
+/*
+ * Copyright (c) 2024 Demant A/S
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+/* Device group model
+ *
+ * All connected devices form one group that is controlled as a whole. The
+ * group keeps the desired state shown in the UI, and for every member the
+ * last reported value and the write in flight of each control.
+ *
+ * Writes are only issued to members whose state diverges from the desired
+ * state. A report that matches the write in flight is the echo of that write
+ * and ends it, any other report during a write predates it and is ignored, so
+ * members never ping-pong values between each other. A report outside of a
+ * write is a change made on the member itself, e.g. from its buttons; it
+ * becomes the desired state and is passed on to the other members.
+ *
+ * Volume steps are relative and sent to every member as such. While a member
+ * is stepping, its reports are taken as the new desired state without being
+ * passed on, as the other members take the same steps themselves.
+ *
+ * An empty group starts from the mix stored for the first member joining, so
+ * the UI shows it right away. With CONFIG_MIX_RESTORE_APPLY the stored mix is
+ * also written to the member in one batch, otherwise the member's first
+ * reports replace it. The values confirmed by the members are stored again.
+ *
+ * Member values are derived from the group values through the role of the
+ * member, e.g. the balance (VOCS offset) is inverted for a left device. Roles
+ * are taken from CONFIG_GROUP_ROLES, members without a configured role are
+ * mono.
+ *
+ * Members may stop notifying a control that is not shown. Their last report
+ * may then go stale, so writes to them are not skipped as redundant.
+ *
+ * The writes of one change are submitted to the command queue as a batch, so
+ * that all members are written back-to-back. The time between the first and
+ * the last echo of such a change is the apply skew between the members.
+ *
+ * A whole state, e.g. a preset, is applied in a single batch of the writes
+ * needed to bring every member to it. The recall is complete once all of them
+ * have been acknowledged or echoed.
+ */
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <zephyr/kernel.h>
+#include <zephyr/sys/printk.h>
+#include <zephyr/shell/shell.h>
+
+#include "group.h"
+#include "ble_cmd.h"
+#include "mix.h"
+
+
+struct group_desired {
+    int16_t value;
+    /* Incremented on every change of the desired value */
+    uint8_t seq;
+    bool valid;
+    /* Members written for the current value whose echo is still awaited */
+    uint32_t echo_wait;
+    uint32_t echo_first_cyc;
+    bool echo_seen;
+};
+
+struct member_ctrl {
+    int16_t reported;
+    int16_t pending;
+    /* Desired state sequence number of the last write and of the last confirmation */
+    uint8_t sent_seq;
+    uint8_t synced_seq;
+    bool reported_valid;
+    bool in_flight;
+    /* The member does not notify changes of the control */
+    bool unwatched;
+    /* Volume steps not taken yet, and the report of the last step still awaited */
+    int16_t step_pending;
+    bool step_echo;
+};
+
+struct group_member {
+    bool present;
+    group_role_t role;
+    uint8_t vocs_count;
+    uint8_t aics_count;
+    struct member_ctrl ctrl[GROUP_CTRL_CNT];
+};
+
+struct group_write {
+    uint8_t conn_idx;
+    int16_t value;
+};
+
+/* The state being applied: controls written and when it started */
+struct group_recall {
+    bool active;
+    uint32_t ctrls;
+    uint32_t start_cyc;
+};
+
+BUILD_ASSERT(GROUP_CTRL_CNT <= 32, "Control masks hold up to 32 controls");
+
+/* Sign of the VOCS offset of a member relative to the group balance */
+static const int8_t role_vocs_sign[] = {
+    [group_role_mono] = 1,
+    [group_role_right] = 1,
+    [group_role_left] = -1,
+};
+
+static struct group_member members[BLE_CONN_CNT];
+static struct group_desired desired[GROUP_CTRL_CNT];
+static struct group_recall recall;
+static group_stats_t stats;
+
+static struct k_spinlock group_lock;
+
+
+static int group_ctrl_idx(group_ctrl_t ctrl, uint8_t inst_idx)
+{
+    switch (ctrl) {
+    case group_vcs_volume:
+        return 0;
+    case group_vcs_mute:
+        return 1;
+    case group_vocs_offset:
+        return (inst_idx < VCP_MAX_VOCS_INST) ? 2 + inst_idx : -1;
+    case group_aics_gain:
+        return (inst_idx < VCP_MAX_AICS_INST) ? 2 + VCP_MAX_VOCS_INST + inst_idx : -1;
+    case group_aics_mute:
+        return (inst_idx < VCP_MAX_AICS_INST) ?
+               2 + VCP_MAX_VOCS_INST + VCP_MAX_AICS_INST + inst_idx : -1;
+    default:
+        return -1;
+    }
+}
+
+/* Inverse of group_ctrl_idx() */
+static void group_ctrl_of(int ctrl_idx, group_ctrl_t *ctrl, uint8_t *inst_idx)
+{
+    if (ctrl_idx < 2) {
+        *ctrl = (ctrl_idx == 0) ? group_vcs_volume : group_vcs_mute;
+        *inst_idx = 0;
+    } else if (ctrl_idx < 2 + VCP_MAX_VOCS_INST) {
+        *ctrl = group_vocs_offset;
+        *inst_idx = ctrl_idx - 2;
+    } else if (ctrl_idx < 2 + VCP_MAX_VOCS_INST + VCP_MAX_AICS_INST) {
+        *ctrl = group_aics_gain;
+        *inst_idx = ctrl_idx - 2 - VCP_MAX_VOCS_INST;
+    } else {
+        *ctrl = group_aics_mute;
+        *inst_idx = ctrl_idx - 2 - VCP_MAX_VOCS_INST - VCP_MAX_AICS_INST;
+    }
+}
+
+/* The transforms are their own inverse, the same function maps both ways */
+static int16_t member_value(const struct group_member *member, group_ctrl_t ctrl, int16_t value)
+{
+    if (ctrl == group_vocs_offset) {
+        return value * role_vocs_sign[member->role];
+    }
+
+    return value;
+}
+
+static bool member_has(const struct group_member *member, group_ctrl_t ctrl, uint8_t inst_idx)
+{
+    switch (ctrl) {
+    case group_vocs_offset:
+        return inst_idx < member->vocs_count;
+    case group_aics_gain:
+    case group_aics_mute:
+        return inst_idx < member->aics_count;
+    default:
+        return true;
+    }
+}
+
+static int member_write(uint8_t conn_idx, group_ctrl_t ctrl, uint8_t inst_idx, int16_t value)
+{
+    switch (ctrl) {
+    case group_vcs_volume:
+        return ble_update_volume(conn_idx, value);
+    case group_vcs_mute:
+        return ble_update_volume_mute(conn_idx, value);
+    case group_vocs_offset:
+        return ble_update_vocs_offset(conn_idx, inst_idx, value);
+    case group_aics_gain:
+        return ble_update_aics_gain(conn_idx, inst_idx, value);
+    case group_aics_mute:
+        return ble_update_aics_mute(conn_idx, inst_idx, value);
+    default:
+        return -EINVAL;
+    }
+}
+
+/*
+ * Collect the writes that bring every present member, except the one at
+ * skip_idx, to the desired state. Members that already report the desired
+ * value or have a write of it in flight are left alone. Called with the lock
+ * held, the writes are issued after it is released.
+ */
+static int group_reconcile(group_ctrl_t ctrl, uint8_t inst_idx, int ctrl_idx, uint8_t skip_idx,
+                           struct group_write *writes)
+{
+    struct group_desired *want = &desired[ctrl_idx];
+    int cnt = 0;
+
+    for (uint8_t i = 0; i < BLE_CONN_CNT; i++) {
+        struct group_member *member = &members[i];
+        struct member_ctrl *mc = &member->ctrl[ctrl_idx];
+
+        if (!member->present || (i == skip_idx) || !member_has(member, ctrl, inst_idx)) {
+            continue;
+        }
+
+        int16_t value = member_value(member, ctrl, want->value);
+
+        if ((mc->in_flight && (mc->pending == value)) ||
+            (!mc->in_flight && mc->reported_valid && !mc->unwatched &&
+             (mc->reported == value))) {
+            mc->synced_seq = want->seq;
+            stats.suppressed++;
+            continue;
+        }
+
+        mc->pending = value;
+        mc->sent_seq = want->seq;
+        mc->in_flight = true;
+
+        writes[cnt].conn_idx = i;
+        writes[cnt].value = value;
+        cnt++;
+    }
+
+    /* The skew is measured across the members written for the same change */
+    want->echo_wait = 0;
+    want->echo_seen = false;
+
+    if (cnt > 1) {
+        for (int i = 0; i < cnt; i++) {
+            want->echo_wait |= BIT(writes[i].conn_idx);
+        }
+    }
+
+    return cnt;
+}
+
+static void group_echo(struct group_desired *want, const struct member_ctrl *mc, uint8_t conn_idx)
+{
+    uint32_t now = k_cycle_get_32();
+
+    if (!(want->echo_wait & BIT(conn_idx)) || (mc->sent_seq != want->seq)) {
+        return;
+    }
+
+    if (!want->echo_seen) {
+        want->echo_first_cyc = now;
+        want->echo_seen = true;
+    }
+
+    want->echo_wait &= ~BIT(conn_idx);
+
+    if (want->echo_wait == 0) {
+        uint32_t skew_us = k_cyc_to_us_floor32(now - want->echo_first_cyc);
+        uint32_t skew_ms = skew_us / 1000U;
+
+        stats.skew_hist[MIN(find_msb_set(skew_ms), GROUP_SKEW_BUCKETS - 1)]++;
+        stats.skew_max_us = MAX(stats.skew_max_us, skew_us);
+    }
+}
+
+/* Called with the group lock held, true when the state being applied just got through */
+static bool group_recall_done(void)
+{
+    if (!recall.active) {
+        return false;
+    }
+
+    for (int i = 0; i < GROUP_CTRL_CNT; i++) {
+        if (!(recall.ctrls & BIT(i))) {
+            continue;
+        }
+
+        for (uint8_t j = 0; j < BLE_CONN_CNT; j++) {
+            if (members[j].present && members[j].ctrl[i].in_flight) {
+                return false;
+            }
+        }
+    }
+
+    recall.active = false;
+    stats.recall_last_us = k_cyc_to_us_floor32(k_cycle_get_32() - recall.start_cyc);
+    stats.recall_max_us = MAX(stats.recall_max_us, stats.recall_last_us);
+
+    return true;
+}
+
+static void group_recall_print(void)
+{
+    printk("Group: %u write(s) of the recalled state done in %u us\n", stats.recall_writes,
+           stats.recall_last_us);
+}
+
+static void group_write_out(group_ctrl_t ctrl, uint8_t inst_idx, int ctrl_idx,
+                            const struct group_write *writes, int cnt)
+{
+    ble_cmd_batch_begin();
+
+    for (int i = 0; i < cnt; i++) {
+        int err = member_write(writes[i].conn_idx, ctrl, inst_idx, writes[i].value);
+        if (err) {
+            k_spinlock_key_t key = k_spin_lock(&group_lock);
+            members[writes[i].conn_idx].ctrl[ctrl_idx].in_flight = false;
+            k_spin_unlock(&group_lock, key);
+        }
+    }
+
+    ble_cmd_batch_end();
+
+    k_spinlock_key_t key = k_spin_lock(&group_lock);
+    stats.writes += cnt;
+    k_spin_unlock(&group_lock, key);
+}
+
+static void group_step_status(const ble_cmd_t *cmd, int err)
+{
+    k_spinlock_key_t key = k_spin_lock(&group_lock);
+    struct member_ctrl *mc = &members[cmd->conn_idx].ctrl[group_ctrl_idx(group_vcs_volume, 0)];
+
+    mc->step_pending -= cmd->value;
+
+    if (!err) {
+        stats.step_ops++;
+        mc->step_echo = (mc->step_pending == 0);
+    }
+
+    k_spin_unlock(&group_lock, key);
+}
+
+static void group_cmd_status(const ble_cmd_t *cmd, int err, uint32_t rtt_us)
+{
+    if (cmd->conn_idx >= BLE_CONN_CNT) {
+        return;
+    }
+
+    group_ctrl_t ctrl;
+
+    switch (cmd->type) {
+    case ble_cmd_vcs_volume:
+        ctrl = group_vcs_volume;
+        break;
+    case ble_cmd_vcs_mute:
+        ctrl = group_vcs_mute;
+        break;
+    case ble_cmd_vocs_offset:
+        ctrl = group_vocs_offset;
+        break;
+    case ble_cmd_aics_gain:
+        ctrl = group_aics_gain;
+        break;
+    case ble_cmd_aics_mute:
+        ctrl = group_aics_mute;
+        break;
+    case ble_cmd_vcs_step:
+        group_step_status(cmd, err);
+        return;
+    default:
+        return;
+    }
+
+    int ctrl_idx = group_ctrl_idx(ctrl, cmd->inst_idx);
+
+    if (ctrl_idx < 0) {
+        return;
+    }
+
+    k_spinlock_key_t key = k_spin_lock(&group_lock);
+    struct member_ctrl *mc = &members[cmd->conn_idx].ctrl[ctrl_idx];
+
+    /* Only the latest write counts, earlier ones were superseded */
+    if (mc->in_flight && (mc->pending == cmd->value)) {
+        mc->in_flight = false;
+
+        if (err) {
+            /* The member state is unknown until its next report */
+            mc->reported_valid = false;
+        } else {
+            /* The server skips the notification when the value did not change */
+            mc->reported = cmd->value;
+            mc->reported_valid = true;
+            mc->synced_seq = mc->sent_seq;
+            mix_store(cmd->conn_idx, ctrl_idx, cmd->value);
+        }
+    }
+
+    bool recalled = group_recall_done();
+
+    k_spin_unlock(&group_lock, key);
+
+    if (recalled) {
+        group_recall_print();
+    }
+}
+
+/* Member i takes the role of the i-th comma separated entry, R, L or M */
+static void group_roles_parse(const char *roles)
+{
+    uint8_t conn_idx = 0;
+
+    for (const char *c = roles; (*c != '\0') && (conn_idx < BLE_CONN_CNT); c++) {
+        switch (*c) {
+        case 'R':
+        case 'r':
+            members[conn_idx].role = group_role_right;
+            break;
+        case 'L':
+        case 'l':
+            members[conn_idx].role = group_role_left;
+            break;
+        case 'M':
+        case 'm':
+            members[conn_idx].role = group_role_mono;
+            break;
+        case ',':
+            conn_idx++;
+            break;
+        default:
+            break;
+        }
+    }
+}
+
+void group_init(void)
+{
+    for (uint8_t i = 0; i < BLE_CONN_CNT; i++) {
+        members[i].role = group_role_mono;
+    }
+
+    group_roles_parse(CONFIG_GROUP_ROLES);
+
+    ble_cmd_status_cb_register(group_cmd_status);
+}
+
+void group_member_join(uint8_t conn_idx, uint8_t vocs_count, uint8_t aics_count)
+{
+    uint8_t restored[GROUP_CTRL_CNT];
+    int restored_cnt = 0;
+
+    if (conn_idx >= BLE_CONN_CNT) {
+        return;
+    }
+
+    /* The bond is settled once the member is discovered, its mix is looked up by it */
+    mix_member_bind(conn_idx);
+
+    k_spinlock_key_t key = k_spin_lock(&group_lock);
+    struct group_member *member = &members[conn_idx];
+
+    memset(member->ctrl, 0, sizeof(member->ctrl));
+    member->vocs_count = vocs_count;
+    member->aics_count = aics_count;
+    member->present = true;
+
+    for (int i = 0; i < GROUP_CTRL_CNT; i++) {
+        group_ctrl_t ctrl;
+        uint8_t inst_idx;
+        int16_t value;
+
+        group_ctrl_of(i, &ctrl, &inst_idx);
+
+        if (desired[i].valid || !member_has(member, ctrl, inst_idx) ||
+            !mix_get(conn_idx, i, &value)) {
+            continue;
+        }
+
+        desired[i].value = member_value(member, ctrl, value);
+        stats.restored++;
+
+#if defined(CONFIG_MIX_RESTORE_APPLY)
+        desired[i].seq++;
+        desired[i].valid = true;
+        restored[restored_cnt++] = i;
+#endif
+    }
+
+    k_spin_unlock(&group_lock, key);
+
+    if (restored_cnt == 0) {
+        return;
+    }
+
+    /* All restored controls go out together, the queue holds them until the member is ready */
+    ble_cmd_batch_begin();
+
+    for (int i = 0; i < restored_cnt; i++) {
+        struct group_write writes[BLE_CONN_CNT];
+        group_ctrl_t ctrl;
+        uint8_t inst_idx;
+        int cnt;
+
+        group_ctrl_of(restored[i], &ctrl, &inst_idx);
+
+        key = k_spin_lock(&group_lock);
+        cnt = group_reconcile(ctrl, inst_idx, restored[i], BLE_CONN_CNT, writes);
+        k_spin_unlock(&group_lock, key);
+
+        group_write_out(ctrl, inst_idx, restored[i], writes, cnt);
+    }
+
+    ble_cmd_batch_end();
+}
+
+void group_member_leave(uint8_t conn_idx)
+{
+    bool empty = true;
+
+    if (conn_idx >= BLE_CONN_CNT) {
+        return;
+    }
+
+    mix_member_unbind(conn_idx);
+
+    k_spinlock_key_t key = k_spin_lock(&group_lock);
+
+    members[conn_idx].present = false;
+
+    for (uint8_t i = 0; i < BLE_CONN_CNT; i++) {
+        empty = empty && !members[i].present;
+    }
+
+    /* A skew measurement waiting for the member is void */
+    for (int i = 0; i < GROUP_CTRL_CNT; i++) {
+        if (desired[i].echo_wait & BIT(conn_idx)) {
+            desired[i].echo_wait = 0;
+        }
+    }
+
+    /* A recall does not wait for the member's writes any longer */
+    bool recalled = group_recall_done();
+
+    /* The next group takes its state from the first member reporting */
+    if (empty) {
+        for (int i = 0; i < GROUP_CTRL_CNT; i++) {
+            desired[i].valid = false;
+        }
+    }
+
+    k_spin_unlock(&group_lock, key);
+
+    if (recalled) {
+        group_recall_print();
+    }
+}
+
+void group_member_watch(uint8_t conn_idx, group_ctrl_t ctrl, uint8_t inst_idx, bool watched)
+{
+    int ctrl_idx = group_ctrl_idx(ctrl, inst_idx);
+
+    if ((ctrl_idx < 0) || (conn_idx >= BLE_CONN_CNT)) {
+        return;
+    }
+
+    k_spinlock_key_t key = k_spin_lock(&group_lock);
+    members[conn_idx].ctrl[ctrl_idx].unwatched = !watched;
+    k_spin_unlock(&group_lock, key);
+}
+
+int16_t group_get(group_ctrl_t ctrl, uint8_t inst_idx)
+{
+    int ctrl_idx = group_ctrl_idx(ctrl, inst_idx);
+
+    return (ctrl_idx >= 0) ? desired[ctrl_idx].value : 0;
+}
+
+int group_set(group_ctrl_t ctrl, uint8_t inst_idx, int16_t value)
+{
+    struct group_write writes[BLE_CONN_CNT];
+    int ctrl_idx = group_ctrl_idx(ctrl, inst_idx);
+    int cnt;
+
+    if (ctrl_idx < 0) {
+        return -EINVAL;
+    }
+
+    k_spinlock_key_t key = k_spin_lock(&group_lock);
+    struct group_desired *want = &desired[ctrl_idx];
+
+    if (want->valid && (want->value == value)) {
+        stats.redundant++;
+        k_spin_unlock(&group_lock, key);
+        return 0;
+    }
+
+    want->value = value;
+    want->seq++;
+    want->valid = true;
+
+    cnt = group_reconcile(ctrl, inst_idx, ctrl_idx, BLE_CONN_CNT, writes);
+    k_spin_unlock(&group_lock, key);
+
+    group_write_out(ctrl, inst_idx, ctrl_idx, writes, cnt);
+
+    return 0;
+}
+
+bool group_report(group_ctrl_t ctrl, uint8_t conn_idx, uint8_t inst_idx, int16_t value)
+{
+    struct group_write writes[BLE_CONN_CNT];
+    int ctrl_idx = group_ctrl_idx(ctrl, inst_idx);
+    uint8_t skip_idx = conn_idx;
+    bool adopted = false;
+    int cnt;
+
+    if ((ctrl_idx < 0) || (conn_idx >= BLE_CONN_CNT)) {
+        return false;
+    }
+
+    k_spinlock_key_t key = k_spin_lock(&group_lock);
+    struct group_member *member = &members[conn_idx];
+    struct member_ctrl *mc = &member->ctrl[ctrl_idx];
+    struct group_desired *want = &desired[ctrl_idx];
+    bool first = !mc->reported_valid;
+
+    mc->reported = value;
+    mc->reported_valid = true;
+    mix_store(conn_idx, ctrl_idx, value);
+
+    if (mc->in_flight) {
+        if (value == mc->pending) {
+            /* The echo of our own write */
+            mc->in_flight = false;
+            mc->synced_seq = mc->sent_seq;
+            stats.echoes++;
+            group_echo(want, mc, conn_idx);
+        } else {
+            /* Sent before our write was applied, the write decides */
+            stats.stale++;
+        }
+
+        bool recalled = group_recall_done();
+
+        k_spin_unlock(&group_lock, key);
+
+        if (recalled) {
+            group_recall_print();
+        }
+
+        return false;
+    }
+
+    int16_t group_value = member_value(member, ctrl, value);
+
+    if ((mc->step_pending != 0) || mc->step_echo) {
+        /* A step result of the member, the others take their own steps */
+        adopted = !want->valid || (want->value != group_value);
+        mc->step_echo = false;
+
+        if (adopted) {
+            want->value = group_value;
+            want->seq++;
+            want->valid = true;
+        }
+
+        mc->synced_seq = want->seq;
+        k_spin_unlock(&group_lock, key);
+        return adopted;
+    }
+
+    if (want->valid && (want->value == group_value)) {
+        mc->synced_seq = want->seq;
+        stats.echoes++;
+        group_echo(want, mc, conn_idx);
+        k_spin_unlock(&group_lock, key);
+        return false;
+    }
+
+    if (want->valid && first) {
+        /* A member joining a running group takes over the group state */
+        skip_idx = BLE_CONN_CNT;
+    } else {
+        /* The member was changed on its own, e.g. from its buttons: follow it */
+        want->value = group_value;
+        want->seq++;
+        want->valid = true;
+        mc->synced_seq = want->seq;
+        stats.adopted++;
+        adopted = true;
+    }
+
+    cnt = group_reconcile(ctrl, inst_idx, ctrl_idx, skip_idx, writes);
+    k_spin_unlock(&group_lock, key);
+
+    group_write_out(ctrl, inst_idx, ctrl_idx, writes, cnt);
+
+    return adopted;
+}
+
+/* Snapshot of the desired state, returns the controls that have a value */
+uint32_t group_state_get(int16_t values[GROUP_CTRL_CNT])
+{
+    uint32_t valid = 0;
+
+    k_spinlock_key_t key = k_spin_lock(&group_lock);
+
+    for (int i = 0; i < GROUP_CTRL_CNT; i++) {
+        values[i] = desired[i].value;
+        valid |= desired[i].valid ? BIT(i) : 0;
+    }
+
+    k_spin_unlock(&group_lock, key);
+
+    return valid;
+}
+
+/*
+ * Applies the masked controls of a state in one pass: only the controls that
+ * change are written, only to the members that differ, and all writes go to
+ * the command queue as one batch across the connections. Returns the number
+ * of writes issued.
+ */
+int group_state_apply(const int16_t values[GROUP_CTRL_CNT], uint32_t mask)
+{
+    struct group_write writes[GROUP_CTRL_CNT][BLE_CONN_CNT];
+    int cnt[GROUP_CTRL_CNT] = {0};
+    int total = 0;
+
+    k_spinlock_key_t key = k_spin_lock(&group_lock);
+
+    for (int i = 0; i < GROUP_CTRL_CNT; i++) {
+        struct group_desired *want = &desired[i];
+        group_ctrl_t ctrl;
+        uint8_t inst_idx;
+
+        if (!(mask & BIT(i))) {
+            continue;
+        }
+
+        if (want->valid && (want->value == values[i])) {
+            stats.redundant++;
+            continue;
+        }
+
+        want->value = values[i];
+        want->seq++;
+        want->valid = true;
+
+        group_ctrl_of(i, &ctrl, &inst_idx);
+        cnt[i] = group_reconcile(ctrl, inst_idx, i, BLE_CONN_CNT, writes[i]);
+        total += cnt[i];
+    }
+
+    stats.recalls++;
+
+    /* A state already in place leaves the timing of the last recall alone */
+    if (total == 0) {
+        k_spin_unlock(&group_lock, key);
+        return 0;
+    }
+
+    /* A recall replaces the one still in progress */
+    recall.active = true;
+    recall.ctrls = 0;
+    recall.start_cyc = k_cycle_get_32();
+    stats.recall_writes = total;
+
+    for (int i = 0; i < GROUP_CTRL_CNT; i++) {
+        recall.ctrls |= (cnt[i] > 0) ? BIT(i) : 0;
+    }
+
+    k_spin_unlock(&group_lock, key);
+
+    ble_cmd_batch_begin();
+
+    for (int i = 0; i < GROUP_CTRL_CNT; i++) {
+        group_ctrl_t ctrl;
+        uint8_t inst_idx;
+
+        if (cnt[i] > 0) {
+            group_ctrl_of(i, &ctrl, &inst_idx);
+            group_write_out(ctrl, inst_idx, i, writes[i], cnt[i]);
+        }
+    }
+
+    ble_cmd_batch_end();
+
+    /* Nothing to wait for when none of the writes could be queued */
+    key = k_spin_lock(&group_lock);
+    bool recalled = group_recall_done();
+    k_spin_unlock(&group_lock, key);
+
+    if (recalled) {
+        group_recall_print();
+    }
+
+    return total;
+}
+
+int group_step(group_ctrl_t ctrl, int8_t steps)
+{
+    uint8_t step_conn[BLE_CONN_CNT];
+    int ctrl_idx = group_ctrl_idx(ctrl, 0);
+    int cnt = 0;
+
+    /* VCS is the only service with relative opcodes */
+    if (ctrl != group_vcs_volume) {
+        return -ENOTSUP;
+    }
+
+    if (steps == 0) {
+        return 0;
+    }
+
+    k_spinlock_key_t key = k_spin_lock(&group_lock);
+
+    for (uint8_t i = 0; i < BLE_CONN_CNT; i++) {
+        if (members[i].present) {
+            members[i].ctrl[ctrl_idx].step_pending += steps;
+            step_conn[cnt++] = i;
+        }
+    }
+
+    stats.steps += abs(steps);
+    k_spin_unlock(&group_lock, key);
+
+    ble_cmd_batch_begin();
+
+    for (int i = 0; i < cnt; i++) {
+        if (ble_step_volume(step_conn[i], steps)) {
+            key = k_spin_lock(&group_lock);
+            members[step_conn[i]].ctrl[ctrl_idx].step_pending -= steps;
+            k_spin_unlock(&group_lock, key);
+        }
+    }
+
+    ble_cmd_batch_end();
+
+    return 0;
+}
+
+void group_stats_get(group_stats_t *group_stats)
+{
+    k_spinlock_key_t key = k_spin_lock(&group_lock);
+    *group_stats = stats;
+    k_spin_unlock(&group_lock, key);
+}
+
+#if defined(CONFIG_SHELL)
+static int group_shell(const struct shell *sh, size_t argc, char **argv)
+{
+    group_stats_t group_stats;
+    uint8_t behind[BLE_CONN_CNT] = {0};
+    uint8_t in_flight[BLE_CONN_CNT] = {0};
+    bool present[BLE_CONN_CNT];
+
+    k_spinlock_key_t key = k_spin_lock(&group_lock);
+
+    group_stats = stats;
+
+    for (uint8_t i = 0; i < BLE_CONN_CNT; i++) {
+        present[i] = members[i].present;
+
+        for (int j = 0; j < GROUP_CTRL_CNT; j++) {
+            const struct member_ctrl *mc = &members[i].ctrl[j];
+
+            behind[i] += (desired[j].valid && mc->reported_valid &&
+                          (mc->synced_seq != desired[j].seq));
+            in_flight[i] += mc->in_flight;
+        }
+    }
+
+    k_spin_unlock(&group_lock, key);
+
+    shell_print(sh, "writes %u, suppressed %u, redundant %u", group_stats.writes,
+                group_stats.suppressed, group_stats.redundant);
+    shell_print(sh, "echoes %u, stale %u, adopted %u", group_stats.echoes,
+                group_stats.stale, group_stats.adopted);
+    shell_print(sh, "volume steps %u, step opcodes %u, restored %u", group_stats.steps,
+                group_stats.step_ops, group_stats.restored);
+    shell_print(sh, "recalls %u, last %u write(s) in %u us, max %u us", group_stats.recalls,
+                group_stats.recall_writes, group_stats.recall_last_us, group_stats.recall_max_us);
+
+    for (uint8_t i = 0; i < BLE_CONN_CNT; i++) {
+        if (present[i]) {
+            shell_print(sh, "Connection %d: %u control(s) behind, %u write(s) in flight",
+                        i, behind[i], in_flight[i]);
+        }
+    }
+
+    shell_print(sh, "apply skew (max %u us):", group_stats.skew_max_us);
+
+    for (int i = 0; i < GROUP_SKEW_BUCKETS; i++) {
+        uint32_t low_ms = (i == 0) ? 0 : BIT(i - 1);
+
+        if (i == GROUP_SKEW_BUCKETS - 1) {
+            shell_print(sh, "  >= %u ms: %u", low_ms, group_stats.skew_hist[i]);
+        } else {
+            shell_print(sh, "  %u-%u ms: %u", low_ms, BIT(i), group_stats.skew_hist[i]);
+        }
+    }
+
+    return 0;
+}
+
+SHELL_SUBCMD_ADD((vcpc), group, NULL, "Show group reconciliation statistics",
+                 group_shell, 1, 0);
+#endif
@@ -0,0 +1,78 @@
+/*
+ * Copyright (c) 2024 Demant A/S
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+/* Header for the device group model */
+
+#ifndef __GROUP_H
+#define __GROUP_H
+
+#include "ble.h"
+
+/* One control per VCS characteristic and VOCS/AICS instance */
+#define GROUP_CTRL_CNT          (2 + VCP_MAX_VOCS_INST + 2 * VCP_MAX_AICS_INST)
+
+/* Apply skew histogram: below 1 ms, then doubling up to 256 ms and above */
+#define GROUP_SKEW_BUCKETS      10
+
+
+typedef enum
+{
+    group_vcs_volume,
+    group_vcs_mute,
+    group_vocs_offset,
+    group_aics_gain,
+    group_aics_mute,
+} group_ctrl_t;
+
+typedef enum
+{
+    group_role_mono,
+    group_role_right,
+    group_role_left,
+} group_role_t;
+
+typedef struct
+{
+    /* Writes issued to members */
+    uint32_t writes;
+    /* Member writes skipped as the member already has the value */
+    uint32_t suppressed;
+    /* Group changes to the value the group already has */
+    uint32_t redundant;
+    /* Reports confirming the desired state */
+    uint32_t echoes;
+    /* Reports overtaken by a write in flight */
+    uint32_t stale;
+    /* Changes made on a member and taken over by the group */
+    uint32_t adopted;
+    /* Volume steps requested, and relative opcodes taken by members */
+    uint32_t steps;
+    uint32_t step_ops;
+    /* Controls of an empty group started from the mix stored for a joining member */
+    uint32_t restored;
+    /* States applied at once, writes of the last one and time until all were acknowledged */
+    uint32_t recalls;
+    uint32_t recall_writes;
+    uint32_t recall_last_us;
+    uint32_t recall_max_us;
+    /* Time between the first and the last echo of a change written to several members */
+    uint32_t skew_hist[GROUP_SKEW_BUCKETS];
+    uint32_t skew_max_us;
+} group_stats_t;
+
+
+void group_init(void);
+void group_member_join(uint8_t conn_idx, uint8_t vocs_count, uint8_t aics_count);
+void group_member_leave(uint8_t conn_idx);
+void group_member_watch(uint8_t conn_idx, group_ctrl_t ctrl, uint8_t inst_idx, bool watched);
+int16_t group_get(group_ctrl_t ctrl, uint8_t inst_idx);
+int group_set(group_ctrl_t ctrl, uint8_t inst_idx, int16_t value);
+int group_step(group_ctrl_t ctrl, int8_t steps);
+bool group_report(group_ctrl_t ctrl, uint8_t conn_idx, uint8_t inst_idx, int16_t value);
+uint32_t group_state_get(int16_t values[GROUP_CTRL_CNT]);
+int group_state_apply(const int16_t values[GROUP_CTRL_CNT], uint32_t mask);
+void group_stats_get(group_stats_t *group_stats);
+
+#endif /* __GROUP_H */
@@ -13,6 +13,7 @@
 #include <zephyr/sys/printk.h>
 #include <zephyr/device.h>
 #include <zephyr/drivers/display.h>
+#include <zephyr/shell/shell.h>
 
 #include "lcd.h"
 
@@ -34,7 +35,18 @@ static lv_style_t button_style_pressed;
 static lv_style_t voice_icon_style;
 static lv_style_t mute_icon_style;
 
-static bool msg_label_created;
+#if defined(CONFIG_LCD_PERF_MONITOR)
+/* Refreshes since the last report: count, pixels and time spent rendering */
+struct lcd_perf {
+    uint32_t start_ms;
+    uint32_t frames;
+    uint64_t px;
+    uint32_t render_ms;
+};
+
+static struct lcd_perf perf;
+static struct k_spinlock perf_lock;
+#endif
 
 
 static void lcd_slider_style_init(void)
@@ -103,37 +115,55 @@ static void lcd_button_style_init(void)
     lv_style_set_transition(&button_style_pressed, &button_trans_dsc);
 }
 
-static void lcd_common_voice_style_init(lv_style_t style)
+static void lcd_common_voice_style_init(lv_style_t *style)
 {
-    lv_style_init(&style);
+    lv_style_init(style);
 
-    lv_style_set_bg_opa(&style, LV_OPA_TRANSP);
-    lv_style_set_bg_color(&style, lv_color_white());
-    lv_style_set_bg_grad_color(&style, lv_color_white());
-    lv_style_set_bg_grad_dir(&style, LV_GRAD_DIR_NONE);
+    lv_style_set_bg_opa(style, LV_OPA_TRANSP);
+    lv_style_set_bg_color(style, lv_color_white());
+    lv_style_set_bg_grad_color(style, lv_color_white());
+    lv_style_set_bg_grad_dir(style, LV_GRAD_DIR_NONE);
 
-    lv_style_set_border_opa(&style, LV_OPA_TRANSP);
-    lv_style_set_border_width(&style, 0);
-    lv_style_set_border_color(&style, lv_color_white());
+    lv_style_set_border_opa(style, LV_OPA_TRANSP);
+    lv_style_set_border_width(style, 0);
+    lv_style_set_border_color(style, lv_color_white());
 
-    lv_style_set_outline_opa(&style, LV_OPA_TRANSP);
-    lv_style_set_outline_color(&style, lv_color_white());
+    lv_style_set_outline_opa(style, LV_OPA_TRANSP);
+    lv_style_set_outline_color(style, lv_color_white());
 
-    lv_style_set_pad_all(&style, 0);
+    lv_style_set_pad_all(style, 0);
 }
 
 static void lcd_voice_icon_style_init(void)
 {
-    lcd_common_voice_style_init(voice_icon_style);
+    lcd_common_voice_style_init(&voice_icon_style);
     lv_style_set_text_color(&voice_icon_style, lv_palette_darken(LV_PALETTE_GREEN, 4));
 }
 
 static void lcd_mute_icon_style_init(void)
 {
-    lcd_common_voice_style_init(mute_icon_style);
+    lcd_common_voice_style_init(&mute_icon_style);
     lv_style_set_text_color(&mute_icon_style, lv_palette_main(LV_PALETTE_RED));
 }
 
+#if defined(CONFIG_LCD_PERF_MONITOR)
+/*
+ * Called by LVGL after every refresh, from the UI thread. The time is spent
+ * rendering; the areas are sent to the display from the flush thread while
+ * the next ones are rendered, so it does not cover the transfers.
+ */
+static void lcd_perf_monitor_cb(lv_disp_drv_t *disp_drv, uint32_t time_ms, uint32_t px)
+{
+    k_spinlock_key_t key = k_spin_lock(&perf_lock);
+
+    perf.frames++;
+    perf.px += px;
+    perf.render_ms += time_ms;
+
+    k_spin_unlock(&perf_lock, key);
+}
+#endif
+
 int lcd_init(void)
 {
     lv_init();
@@ -150,15 +180,47 @@ int lcd_init(void)
     lcd_voice_icon_style_init();
     lcd_mute_icon_style_init();
 
+#if defined(CONFIG_LCD_PERF_MONITOR)
+    lv_disp_get_default()->driver->monitor_cb = lcd_perf_monitor_cb;
+    perf.start_ms = k_uptime_get_32();
+#endif
+
     return 0;
 }
 
-void lcd_clear_screen(lv_obj_t *parent)
+lv_obj_t *lcd_create_screen(void)
+{
+    lv_obj_t *screen = lv_obj_create(NULL);
+
+    lv_obj_clear_flag(screen, LV_OBJ_FLAG_SCROLLABLE);
+
+    return screen;
+}
+
+lv_obj_t *lcd_create_scroll_area(lv_obj_t *parent, lv_event_cb_t cb)
 {
-    msg_label_created = false;
-    k_sleep(K_MSEC(300));
-    lv_obj_clean(parent);
-    k_sleep(K_MSEC(300));
+    lv_obj_t *area = lv_obj_create(parent);
+    lv_obj_remove_style_all(area);
+
+    lv_obj_set_size(area, LV_PCT(100), LV_PCT(100));
+    lv_obj_set_scroll_dir(area, LV_DIR_VER);
+    lv_obj_set_scrollbar_mode(area, LV_SCROLLBAR_MODE_ACTIVE);
+
+    lv_obj_add_event_cb(area, cb, LV_EVENT_ALL, NULL);
+
+    return area;
+}
+
+lv_obj_t *lcd_create_row(lv_obj_t *parent, lv_coord_t h)
+{
+    lv_obj_t *row = lv_obj_create(parent);
+    lv_obj_remove_style_all(row);
+
+    /* Presses on the row scroll the area it is in */
+    lv_obj_clear_flag(row, LV_OBJ_FLAG_SCROLLABLE | LV_OBJ_FLAG_CLICKABLE);
+    lv_obj_set_size(row, LV_PCT(100), h);
+
+    return row;
 }
 
 lv_obj_t *lcd_create_slider(lv_obj_t *parent, int16_t min_value, int16_t max_value,
@@ -177,11 +239,17 @@ lv_obj_t *lcd_create_slider(lv_obj_t *parent, int16_t min_value, int16_t max_val
 
     lv_obj_center(slider);
 
+    /* Dragging the knob is not a swipe of the screen */
+    lv_obj_clear_flag(slider, LV_OBJ_FLAG_GESTURE_BUBBLE);
+
     lv_obj_set_width(slider, 170);
     lv_obj_set_height(slider, 15);
     lv_obj_align(slider, LV_ALIGN_CENTER, x, y);
 
     lv_obj_add_event_cb(slider, cb, LV_EVENT_RELEASED, NULL);
+#if defined(CONFIG_SLIDER_STREAMING)
+    lv_obj_add_event_cb(slider, cb, LV_EVENT_VALUE_CHANGED, NULL);
+#endif
 
     lv_slider_set_range(slider, min_value, max_value);
     lv_slider_set_value(slider, 0, LV_ANIM_OFF);
@@ -214,8 +282,6 @@ lv_obj_t *lcd_create_label(lv_obj_t *parent, const char *text, lv_coord_t x, lv_
     lv_label_set_text(msg_label, text);
     lv_obj_align(msg_label, LV_ALIGN_CENTER, x, y);
 
-    msg_label_created = true;
-
     return msg_label;
 }
 
@@ -224,6 +290,8 @@ lv_obj_t *lcd_create_voice_icon(lv_obj_t *parent, lv_coord_t x, lv_coord_t y, lv
     lv_obj_t *icon = lv_btn_create(parent);
     lv_obj_remove_style_all(icon);
     lv_obj_add_style(icon, &voice_icon_style, LV_PART_MAIN);
+    /* Muted is shown through the checked state, the style list never changes */
+    lv_obj_add_style(icon, &mute_icon_style, LV_PART_MAIN | LV_STATE_CHECKED);
 
     lv_obj_set_size(icon, 30, 30);
     lv_obj_align(icon, LV_ALIGN_CENTER, x, y);
@@ -231,7 +299,7 @@ lv_obj_t *lcd_create_voice_icon(lv_obj_t *parent, lv_coord_t x, lv_coord_t y, lv
     lv_obj_add_event_cb(icon, cb, LV_EVENT_RELEASED, NULL);
 
     lv_obj_t *label = lv_label_create(icon);
-    lv_label_set_text(label, LV_SYMBOL_VOLUME_MAX);
+    lv_label_set_text_static(label, LV_SYMBOL_VOLUME_MAX);
     lv_obj_center(label);
 
     return icon;
@@ -260,17 +328,55 @@ void lcd_change_voice_icon(lv_obj_t *icon, uint8_t mute)
     lv_obj_t *label = lv_obj_get_child(icon, 0);
 
     if (mute) {
-        lv_obj_add_style(icon, &mute_icon_style, LV_PART_MAIN);
-        lv_label_set_text(label, LV_SYMBOL_VOLUME_MID);
+        lv_obj_add_state(icon, LV_STATE_CHECKED);
+        lv_label_set_text_static(label, LV_SYMBOL_VOLUME_MID);
     } else {
-        lv_obj_add_style(icon, &voice_icon_style, LV_PART_MAIN);
-        lv_label_set_text(label, LV_SYMBOL_VOLUME_MAX);
+        lv_obj_clear_state(icon, LV_STATE_CHECKED);
+        lv_label_set_text_static(label, LV_SYMBOL_VOLUME_MAX);
+    }
+}
+
+void lcd_update_slider(lv_obj_t *slider, int32_t value)
+{
+    /* Do not move the knob under the user's finger */
+    if (lv_obj_has_state(slider, LV_STATE_PRESSED)) {
+        return;
     }
+
+    lv_slider_set_value(slider, value, LV_ANIM_OFF);
 }
 
 void lcd_display_message(lv_obj_t *lbl, const char *msg)
 {
-    if(msg_label_created) {
+    if (lbl != NULL) {
         lv_label_set_text(lbl, msg);
     }
 }
+
+#if defined(CONFIG_LCD_PERF_MONITOR) && defined(CONFIG_SHELL)
+static int lcd_perf_shell(const struct shell *sh, size_t argc, char **argv)
+{
+    k_spinlock_key_t key = k_spin_lock(&perf_lock);
+    struct lcd_perf p = perf;
+
+    /* Start a new measurement window with every report */
+    memset(&perf, 0, sizeof(perf));
+    perf.start_ms = k_uptime_get_32();
+
+    k_spin_unlock(&perf_lock, key);
+
+    uint32_t elapsed_ms = MAX(perf.start_ms - p.start_ms, 1U);
+    uint64_t bytes = p.px * (LV_COLOR_DEPTH / 8);
+
+    shell_print(sh, "%u frame(s) in %u ms: %u.%u fps", p.frames, elapsed_ms,
+                p.frames * 1000U / elapsed_ms, (p.frames * 10000U / elapsed_ms) % 10);
+    shell_print(sh, "%llu px rendered in %u ms: %llu kB/s render throughput", p.px, p.render_ms,
+                (p.render_ms > 0) ? bytes / p.render_ms : 0);
+    shell_print(sh, "%llu kB/s flushed on average", bytes / elapsed_ms);
+
+    return 0;
+}
+
+SHELL_SUBCMD_ADD((vcpc), lcd, NULL, "Show display frame rate and throughput since the last call",
+                 lcd_perf_shell, 1, 0);
+#endif
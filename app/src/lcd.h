@@ -16,6 +16,9 @@
 
 int lcd_init(void);
 
+lv_obj_t *lcd_create_screen(void);
+lv_obj_t *lcd_create_scroll_area(lv_obj_t *parent, lv_event_cb_t cb);
+lv_obj_t *lcd_create_row(lv_obj_t *parent, lv_coord_t h);
 lv_obj_t *lcd_create_slider(lv_obj_t *parent, int16_t min_value,int16_t max_value,
                             lv_coord_t x, lv_coord_t y, lv_event_cb_t cb);
 lv_obj_t *lcd_create_button(lv_obj_t *parent, const char *text, int32_t w, int32_t h,
@@ -24,8 +27,8 @@ lv_obj_t *lcd_create_label(lv_obj_t *parent, const char *text, lv_coord_t x, lv_
 lv_obj_t *lcd_create_voice_icon(lv_obj_t *parent, lv_coord_t x, lv_coord_t y, lv_event_cb_t cb);
 lv_obj_t *lcd_create_balance_icon(lv_obj_t *parent, lv_coord_t x, lv_coord_t y, lv_event_cb_t cb);
 
-void lcd_clear_screen(lv_obj_t *parent);
 void lcd_display_message(lv_obj_t *lbl, const char *msg);
 void lcd_change_voice_icon(lv_obj_t *icon, uint8_t mute);
+void lcd_update_slider(lv_obj_t *slider, int32_t value);
 
 #endif /* __LCD_H */
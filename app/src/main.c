@@ -8,185 +8,401 @@
 #include <string.h>
 #include <lvgl.h>
 #include <zephyr/kernel.h>
+#include <zephyr/sys/atomic.h>
 #include <zephyr/sys/printk.h>
+#include <zephyr/shell/shell.h>
+#include <zephyr/input/input.h>
 
 #include "lcd.h"
 #include "ble.h"
+#include "ble_scan.h"
+#include "group.h"
+#include "preset.h"
+#include "ui_bind.h"
+#include "ui_evt.h"
+
+/* Scan results listed on screen, strongest first */
+#define SCAN_RESULTS_SHOWN  4
+
+#define UI_INPUT_IDLE_MS    CONFIG_UI_INPUT_IDLE_MS
+
+/* The preset buttons run along the bottom of the slider screen */
+#define PRESET_BAR_H        36
+#define SLIDERS_AREA_H      ((LCD_Y_MAX - LCD_Y_MIN) - PRESET_BAR_H)
+
+/* Slider rows are only instantiated for the part of the list on screen */
+#define SLIDER_ROW_H        48
+#define SLIDER_ROWS_POOL    (DIV_ROUND_UP(SLIDERS_AREA_H, SLIDER_ROW_H) + 1)
+
+BUILD_ASSERT(2 * SLIDER_ROWS_POOL <= UI_BIND_MAX);
 
 
 static bool target_device_connected[BLE_CONN_CNT];
 static bool target_device_vcp_discovered[BLE_CONN_CNT];
 static bool connect_all_targets;
-static bool vcp_discover_all_targets;
 static bool all_devices_detected;
-static uint8_t aics_inst_cnt[VCP_MAX_AICS_INST];
-static uint8_t vocs_inst_cnt[VCP_MAX_VOCS_INST];
-static uint8_t aics_mute[VCP_MAX_AICS_INST];
-static int8_t aics_gain[VCP_MAX_AICS_INST];
-static int16_t vocs_offset[VCP_MAX_VOCS_INST];
-static uint8_t vcs_volume = 0;
-static uint8_t vcs_mute = 0;
-
-static lv_obj_t *scr;
-static lv_obj_t *vcs_volume_slider;
-static lv_obj_t *vcs_voice_icon;
-static lv_obj_t *vocs_slider[VCP_MAX_VOCS_INST];
-static lv_obj_t *vocs_voice_icon[VCP_MAX_VOCS_INST];
-static lv_obj_t *aics_slider[VCP_MAX_AICS_INST];
-static lv_obj_t *aics_voice_icon[VCP_MAX_AICS_INST];
+static bool sliders_shown;
+static uint8_t aics_inst_cnt[BLE_CONN_CNT];
+static uint8_t vocs_inst_cnt[BLE_CONN_CNT];
+
+/* The screens are built once and switched with lv_scr_load() */
+static lv_obj_t *disconnected_scr;
+static lv_obj_t *connected_scr;
+static lv_obj_t *sliders_scr;
+
+static lv_obj_t *disconnected_msg_label;
+static lv_obj_t *connected_msg_label;
 static lv_obj_t *msg_label;
 
-#if (BLE_CONN_CNT == 2)
-static bool vocs_offset_changed;
-static bool aics_gain_changed;
-static bool aics_mute_changed;
-static bool vcs_volume_changed;
-static bool vcs_mute_changed;
-#endif
+/* A row of the slider list: the volume, then every VOCS and AICS instance */
+struct slider_row {
+    lv_obj_t *obj;
+    lv_obj_t *label;
+    lv_obj_t *slider;
+    lv_obj_t *voice_icon;
+    lv_obj_t *balance_icon;
+    /* Row of the list shown, -1 if the widgets are not in use */
+    int16_t row_idx;
+    group_ctrl_t slider_ctrl;
+    group_ctrl_t mute_ctrl;
+    uint8_t inst_idx;
+};
+
+static lv_obj_t *sliders_area;
+static struct slider_row slider_rows[SLIDER_ROWS_POOL];
+static uint8_t slider_vocs_cnt;
+static uint8_t slider_aics_cnt;
+static uint32_t slider_rows_rebound;
+
+static lv_obj_t *preset_btns[PRESET_CNT];
+
+/* Latest VCP states received since the last frame, one slot per control instance */
+static vcp_vol_state_t pending_vol_state[BLE_CONN_CNT];
+static vcp_vocs_state_t pending_vocs_state[BLE_CONN_CNT][VCP_MAX_VOCS_INST];
+static vcp_aics_state_t pending_aics_state[BLE_CONN_CNT][VCP_MAX_AICS_INST];
+static bool pending_vol_valid[BLE_CONN_CNT];
+static bool pending_vocs_valid[BLE_CONN_CNT][VCP_MAX_VOCS_INST];
+static bool pending_aics_valid[BLE_CONN_CNT][VCP_MAX_AICS_INST];
+static bool pending_states;
+
+/* Volume steps from the buttons and swipes since the last frame */
+static int16_t pending_vol_steps;
+
+/* Touch input is only polled by LVGL while the screen is in use */
+static atomic_t touch_activity;
+static bool touch_polling = true;
+static uint32_t touch_last_ms;
+
+static uint32_t ui_wakeups_evt;
+static uint32_t ui_wakeups_timer;
+
+
+static struct slider_row *slider_row_get(lv_event_t *e)
+{
+    return lv_obj_get_user_data(lv_obj_get_parent(lv_event_get_target(e)));
+}
 
+static void slider_event_cb(lv_event_t *e)
+{
+    struct slider_row *row = slider_row_get(e);
+
+    group_set(row->slider_ctrl, row->inst_idx, lv_slider_get_value(row->slider));
+}
 
-static void vcs_volume_slider_event_cb(lv_event_t *e)
+static void voice_icon_event_cb(lv_event_t *e)
 {
-    lv_obj_t *slider = lv_event_get_target(e);
-    int16_t value = lv_slider_get_value(slider);
+    struct slider_row *row = slider_row_get(e);
 
-    vcs_volume = value;
-    ble_update_volume(conn_tgt, value);
+    group_set(row->mute_ctrl, row->inst_idx, !group_get(row->mute_ctrl, row->inst_idx));
+    ui_bind_refresh();
+}
 
-#if (BLE_CONN_CNT == 2)
-    vcs_volume_changed = true;
-#endif
+static void preset_btns_update(void)
+{
+    char name[PRESET_NAME_LEN];
+
+    for (uint8_t i = 0; i < PRESET_CNT; i++) {
+        preset_name(i, name);
+        lv_label_set_text(lv_obj_get_child(preset_btns[i], 0), name);
+    }
 }
 
-static void vocs_slider_event_cb(lv_event_t *e)
+/* A short click recalls the preset, a long press saves the current mix to it */
+static void preset_btn_event_cb(lv_event_t *e)
 {
-    lv_obj_t *slider = lv_event_get_target(e);
-    int16_t value = lv_slider_get_value(slider);
+    lv_event_code_t code = lv_event_get_code(e);
+    lv_obj_t *btn = lv_event_get_target(e);
+    uint8_t idx;
+    int ret;
+
+    for (idx = 0; idx < PRESET_CNT; idx++) {
+        if (preset_btns[idx] == btn) {
+            break;
+        }
+    }
 
-    for (uint8_t i = 0; i < VCP_MAX_VOCS_INST; i++) {
-        if(slider == vocs_slider[i]) {
-            vocs_offset[i] = value;
-            ble_update_vocs_offset(conn_tgt, i, value);
+    if (idx == PRESET_CNT) {
+        return;
+    }
 
-#if (BLE_CONN_CNT == 2)
-            vocs_offset_changed = true;
-#endif
+    if (code == LV_EVENT_LONG_PRESSED) {
+        ret = preset_save(idx, NULL);
+        if (ret) {
+            printk("Preset %u: save failed (%d)\n", idx, ret);
+            return;
         }
+
+        printk("Preset %u: saved\n", idx);
+        preset_btns_update();
+        return;
     }
+
+    /* Not sent after a long press, unlike LV_EVENT_CLICKED */
+    if (code != LV_EVENT_SHORT_CLICKED) {
+        return;
+    }
+
+    ret = preset_recall(idx);
+    if (ret < 0) {
+        printk("Preset %u: recall failed (%d)\n", idx, ret);
+        return;
+    }
+
+    printk("Preset %u: recalled with %d write(s)\n", idx, ret);
+    ui_bind_refresh();
+}
+
+/* Swipes are horizontal, LVGL takes vertical drags on the slider list as scrolling */
+static void scr_gesture_event_cb(lv_event_t *e)
+{
+    lv_dir_t dir = lv_indev_get_gesture_dir(lv_indev_get_act());
+
+    if (dir == LV_DIR_RIGHT) {
+        pending_vol_steps++;
+    } else if (dir == LV_DIR_LEFT) {
+        pending_vol_steps--;
+    }
+}
+
+static uint8_t slider_row_cnt(void)
+{
+    return 1 + slider_vocs_cnt + slider_aics_cnt;
 }
 
-static void aics_slider_event_cb(lv_event_t *e)
+/* Points the widgets of a pooled row at a row of the list */
+static void slider_row_show(struct slider_row *row, int16_t row_idx)
 {
-    lv_obj_t *slider = lv_event_get_target(e);
-    int16_t value = lv_slider_get_value(slider);
+    char txt[10];
+
+    if (row->row_idx == row_idx) {
+        return;
+    }
 
-    for (uint8_t i = 0; i < VCP_MAX_AICS_INST; i++) {
-        if(slider == aics_slider[i]) {
-            aics_gain[i] = value;
-            ble_update_aics_gain(conn_tgt, i, value);
+    row->row_idx = row_idx;
 
-#if (BLE_CONN_CNT == 2)
-            aics_gain_changed = true;
+    if (row_idx < 0) {
+        lv_obj_add_flag(row->obj, LV_OBJ_FLAG_HIDDEN);
+        ui_bind_remove(row->slider);
+        ui_bind_remove(row->voice_icon);
+        return;
+    }
+
+    if (row_idx == 0) {
+        snprintf(txt, sizeof(txt), "Volume");
+        lv_slider_set_range(row->slider, VOLUME_MIN, VOLUME_MAX);
+        row->slider_ctrl = group_vcs_volume;
+        row->mute_ctrl = group_vcs_mute;
+        row->inst_idx = 0;
+    } else if (row_idx <= slider_vocs_cnt) {
+        row->inst_idx = row_idx - 1;
+#if (VCP_MAX_VOCS_INST == 1)
+        snprintf(txt, sizeof(txt), "Balance");
+#else
+        snprintf(txt, sizeof(txt), "VOCS-%d", row->inst_idx);
+#endif
+        lv_slider_set_range(row->slider, VOCS_OFFSET_MIN, VOCS_OFFSET_MAX);
+        row->slider_ctrl = group_vocs_offset;
+    } else {
+        row->inst_idx = row_idx - 1 - slider_vocs_cnt;
+#if (VCP_MAX_AICS_INST == 1)
+        snprintf(txt, sizeof(txt), "AICS");
+#else
+        snprintf(txt, sizeof(txt), "AICS-%d", row->inst_idx);
 #endif
-       }
+        lv_slider_set_range(row->slider, AICS_GAIN_MIN, AICS_GAIN_MAX);
+        row->slider_ctrl = group_aics_gain;
+        row->mute_ctrl = group_aics_mute;
     }
+
+    lv_label_set_text(row->label, txt);
+    lv_obj_set_y(row->obj, row_idx * SLIDER_ROW_H);
+    lv_obj_clear_flag(row->obj, LV_OBJ_FLAG_HIDDEN);
+
+    ui_bind_add(row->slider, ui_bind_slider, row->slider_ctrl, row->inst_idx);
+
+    /* VOCS rows have a balance icon instead of a mute button */
+    if (row->slider_ctrl == group_vocs_offset) {
+        ui_bind_remove(row->voice_icon);
+        lv_obj_add_flag(row->voice_icon, LV_OBJ_FLAG_HIDDEN);
+        lv_obj_clear_flag(row->balance_icon, LV_OBJ_FLAG_HIDDEN);
+    } else {
+        ui_bind_add(row->voice_icon, ui_bind_mute_icon, row->mute_ctrl, row->inst_idx);
+        lv_obj_clear_flag(row->voice_icon, LV_OBJ_FLAG_HIDDEN);
+        lv_obj_add_flag(row->balance_icon, LV_OBJ_FLAG_HIDDEN);
+    }
+
+    slider_rows_rebound++;
 }
 
-static void vcs_voice_icon_event_cb(lv_event_t *e)
+static bool slider_inst_shown(group_ctrl_t slider_ctrl, uint8_t inst_idx)
 {
-    lv_obj_t *icon = lv_event_get_target(e);
+    if (!sliders_shown) {
+        return false;
+    }
 
-    vcs_mute = !vcs_mute;
-    ble_update_volume_mute(conn_tgt, vcs_mute);
-    lcd_change_voice_icon(icon, vcs_mute);
+    for (uint8_t i = 0; i < SLIDER_ROWS_POOL; i++) {
+        if ((slider_rows[i].row_idx >= 0) && (slider_rows[i].slider_ctrl == slider_ctrl) &&
+            (slider_rows[i].inst_idx == inst_idx)) {
+            return true;
+        }
+    }
 
-#if (BLE_CONN_CNT == 2)
-    vcs_mute_changed = true;
-#endif
+    return false;
 }
 
-static void aics_voice_icon_event_cb(lv_event_t *e)
+/* Devices only notify the VOCS and AICS instances with a row on screen */
+static void vcp_subscriptions_update(void)
 {
-    lv_obj_t *icon = lv_event_get_target(e);
+    for (uint8_t i = 0; i < BLE_CONN_CNT; i++) {
+        if (!target_device_vcp_discovered[i]) {
+            continue;
+        }
 
-    for (uint8_t i = 0; i < VCP_MAX_AICS_INST; i++) {
-        if(icon == aics_voice_icon[i]) {
-            aics_mute[i] = !aics_mute[i];
-            ble_update_aics_mute(conn_tgt, i, aics_mute[i]);
-            lcd_change_voice_icon(icon, aics_mute[i]);
+        for (uint8_t j = 0; j < vocs_inst_cnt[i]; j++) {
+            bool shown = slider_inst_shown(group_vocs_offset, j);
 
-#if (BLE_CONN_CNT == 2)
-            aics_mute_changed = true;
-#endif
+            ble_vcp_subscribe(i, vcp_vocs_state, j, shown);
+            group_member_watch(i, group_vocs_offset, j, shown);
+        }
+
+        for (uint8_t j = 0; j < aics_inst_cnt[i]; j++) {
+            bool shown = slider_inst_shown(group_aics_gain, j);
+
+            ble_vcp_subscribe(i, vcp_aics_state, j, shown);
+            group_member_watch(i, group_aics_gain, j, shown);
+            group_member_watch(i, group_aics_mute, j, shown);
         }
     }
 }
 
-static void create_sliders(void)
+/* Row i of the list always goes to pooled row i % SLIDER_ROWS_POOL, so rows
+ * staying on screen while scrolling keep their widgets */
+static void sliders_area_update(void)
 {
-    char txt[10];
-    lv_obj_t *vcs_volume_label;
-    lv_obj_t *vocs_label[VCP_MAX_VOCS_INST];
-    lv_obj_t *aics_label[VCP_MAX_AICS_INST];
-    lv_coord_t scr_y = LCD_Y_MIN;
-    const int dist = (LCD_Y_MAX - LCD_Y_MIN) / (VCP_MAX_VOCS_INST + VCP_MAX_AICS_INST + 2);
+    int16_t first = MAX(lv_obj_get_scroll_y(sliders_area), 0) / SLIDER_ROW_H;
+    uint32_t rebound = slider_rows_rebound;
 
-    lcd_clear_screen(scr);
+    for (int16_t i = first; i < first + SLIDER_ROWS_POOL; i++) {
+        slider_row_show(&slider_rows[i % SLIDER_ROWS_POOL], (i < slider_row_cnt()) ? i : -1);
+    }
 
-    snprintf(txt, sizeof(txt), "Volume");
-    scr_y += dist;
+    if (slider_rows_rebound != rebound) {
+        vcp_subscriptions_update();
+    }
 
-    vcs_volume_slider = lcd_create_slider(scr, VOLUME_MIN, VOLUME_MAX, 10, scr_y,
-                                          vcs_volume_slider_event_cb);
+    ui_bind_refresh();
+}
 
-    vcs_volume_label = lcd_create_label(scr, txt, -120, scr_y);
-    vcs_voice_icon = lcd_create_voice_icon(scr, 125, scr_y, vcs_voice_icon_event_cb);
+static void sliders_area_event_cb(lv_event_t *e)
+{
+    lv_event_code_t code = lv_event_get_code(e);
 
-    for (uint8_t i = 0; i < VCP_MAX_VOCS_INST; ++i) {
-#if (VCP_MAX_VOCS_INST == 1)
-        snprintf(txt, sizeof(txt), "Balance");
-#else
-        snprintf(txt, sizeof(txt), "VOCS-%d", i);
-#endif
-        scr_y += dist;
+    if (code == LV_EVENT_GET_SELF_SIZE) {
+        /* The scroll range covers every row, also those without widgets */
+        lv_point_t *size = lv_event_get_param(e);
+
+        size->y = MAX(size->y, slider_row_cnt() * SLIDER_ROW_H);
+    } else if (code == LV_EVENT_SCROLL) {
+        sliders_area_update();
+    }
+}
 
-        vocs_slider[i] = lcd_create_slider(scr, VOCS_OFFSET_MIN, VOCS_OFFSET_MAX, 10, scr_y,
-                                           vocs_slider_event_cb);
+static void build_sliders_screen(void)
+{
+    sliders_area = lcd_create_scroll_area(sliders_scr, sliders_area_event_cb);
+    lv_obj_set_height(sliders_area, SLIDERS_AREA_H);
+
+    for (uint8_t i = 0; i < SLIDER_ROWS_POOL; i++) {
+        struct slider_row *row = &slider_rows[i];
+
+        row->obj = lcd_create_row(sliders_area, SLIDER_ROW_H);
+        lv_obj_set_user_data(row->obj, row);
 
-        vocs_label[i] = lcd_create_label(scr, txt, -120, scr_y);
-        vocs_voice_icon[i] = lcd_create_balance_icon(scr, 125, scr_y, NULL);
+        row->slider = lcd_create_slider(row->obj, VOLUME_MIN, VOLUME_MAX, 10, 0,
+                                        slider_event_cb);
+        row->label = lcd_create_label(row->obj, "", -120, 0);
+        row->voice_icon = lcd_create_voice_icon(row->obj, 125, 0, voice_icon_event_cb);
+        row->balance_icon = lcd_create_balance_icon(row->obj, 125, 0, NULL);
+
+        lv_obj_add_flag(row->obj, LV_OBJ_FLAG_HIDDEN);
+        row->row_idx = -1;
     }
 
-    for (uint8_t i = 0; i < VCP_MAX_AICS_INST; ++i) {
-#if (VCP_MAX_VOCS_INST == 1)
-        snprintf(txt, sizeof(txt), "AICS");
-#else
-        snprintf(txt, sizeof(txt), "AICS-%d", i);
-#endif
-        scr_y += dist;
+    for (uint8_t i = 0; i < PRESET_CNT; i++) {
+        lv_coord_t w = (LCD_X_MAX - LCD_X_MIN) / PRESET_CNT;
+
+        preset_btns[i] = lcd_create_button(sliders_scr, "", w - 8, PRESET_BAR_H - 6,
+                                           LCD_X_MIN + (w * i) + (w / 2),
+                                           LCD_Y_MAX - (PRESET_BAR_H / 2), preset_btn_event_cb);
+        lv_obj_add_event_cb(preset_btns[i], preset_btn_event_cb, LV_EVENT_SHORT_CLICKED, NULL);
+        lv_obj_add_event_cb(preset_btns[i], preset_btn_event_cb, LV_EVENT_LONG_PRESSED, NULL);
+    }
+}
+
+/* The list has a row for every instance discovered on a device of the group */
+static void show_sliders(void)
+{
+    uint8_t vocs_cnt = 0;
+    uint8_t aics_cnt = 0;
 
-        aics_slider[i] = lcd_create_slider(scr, AICS_GAIN_MIN, AICS_GAIN_MAX, 10, scr_y,
-                                           aics_slider_event_cb);
+    for (uint8_t i = 0; i < BLE_CONN_CNT; i++) {
+        vocs_cnt = MAX(vocs_cnt, vocs_inst_cnt[i]);
+        aics_cnt = MAX(aics_cnt, aics_inst_cnt[i]);
+    }
 
-        aics_label[i] = lcd_create_label(scr, txt, -120, scr_y);
-        aics_voice_icon[i] = lcd_create_voice_icon(scr, 125, scr_y, aics_voice_icon_event_cb);
+    /* The rows may now stand for other instances */
+    for (uint8_t i = 0; i < SLIDER_ROWS_POOL; i++) {
+        slider_row_show(&slider_rows[i], -1);
     }
+
+    slider_vocs_cnt = vocs_cnt;
+    slider_aics_cnt = aics_cnt;
+
+    /* A list shorter than the area is centered, a longer one scrolls */
+    lv_obj_set_style_pad_top(sliders_area,
+                             MAX(SLIDERS_AREA_H - slider_row_cnt() * SLIDER_ROW_H, 0) / 2,
+                             LV_PART_MAIN);
+    preset_btns_update();
+    lv_obj_refresh_self_size(sliders_area);
+    lv_obj_scroll_to_y(sliders_area, 0, LV_ANIM_OFF);
+
+    sliders_shown = true;
+    sliders_area_update();
+    lv_scr_load(sliders_scr);
 }
 
-static int connect_first_disconnected_devic(uint8_t start_conn_idx)
+static int connect_all_devices(void)
 {
-    int err;
-    uint8_t conn_idx = start_conn_idx;
+    int ret = 0;
 
-    do {
-        err = ble_connect(conn_idx);
-        if (err < 0) {
-            lcd_display_message(msg_label, "Connection failed!");
-            return -1;
+    /* The BLE module creates the connections one at a time and sets each one up on its own */
+    for (uint8_t i = 0; i < BLE_CONN_CNT; i++) {
+        if (ble_connect(i) < 0) {
+            ret = -1;
         }
-    } while ((err > 0) && (++conn_idx < BLE_CONN_CNT));
+    }
 
-    return 0;
+    return ret;
 }
 
 static void scan_btn_event_cb(lv_event_t *e)
@@ -209,8 +425,7 @@ static void connect_btn_event_cb(lv_event_t *e)
     lcd_display_message(msg_label, "Connecting...");
 
     if (all_devices_detected) {
-        uint8_t first_conn_idx = 0;
-        int err = connect_first_disconnected_devic(first_conn_idx);
+        int err = connect_all_devices();
         if (err) {
             lcd_display_message(msg_label, "Connection failed!");
         }
@@ -228,14 +443,14 @@ static void discover_btn_event_cb(lv_event_t *e)
         target_device_vcp_discovered[i] = false;
     }
 
-    vcp_discover_all_targets = true;
-    uint8_t first_conn_idx = 0;
-    int err = ble_vcp_discover(first_conn_idx);
-    if (err) {
-        char txt[50];
-        snprintf(txt, sizeof(txt), "Connection %d: VCP discover failed!", first_conn_idx);
-        lcd_display_message(msg_label, txt);
-        return;
+    for (uint8_t i = 0; i < BLE_CONN_CNT; i++) {
+        int err = ble_vcp_discover(i);
+        if (err) {
+            char txt[50];
+            snprintf(txt, sizeof(txt), "Connection %d: VCP discover failed!", i);
+            lcd_display_message(msg_label, txt);
+            return;
+        }
     }
 
     lcd_display_message(msg_label, "Start discovering VCP...");
@@ -255,52 +470,82 @@ static void disconnect_btn_event_cb(lv_event_t *e)
     }
 
     connect_all_targets = false;
-    vcp_discover_all_targets = false;
 }
 
-static void create_buttons_before_connecting(void)
+static void build_disconnected_screen(void)
 {
-    lv_obj_t *connect_btn, *scan_btn;
+    lv_obj_t *scr = disconnected_scr;
 
-    lcd_clear_screen(scr);
+    lcd_create_button(scr, "Connect", 100, 50, -60, -20, connect_btn_event_cb);
+    lcd_create_button(scr, "Scan", 100, 50, 60, -20, scan_btn_event_cb);
 
-    connect_btn = lcd_create_button(scr, "Connect", 100, 50, -60, -20, connect_btn_event_cb);
-    scan_btn = lcd_create_button(scr, "Scan", 100, 50, 60, -20, scan_btn_event_cb);
-
-    msg_label = lcd_create_label(scr, "Not connected.", 0, 50);
+    disconnected_msg_label = lcd_create_label(scr, "Not connected.", 0, 50);
 }
 
-static void create_buttons_after_connecting(void)
+static void build_connected_screen(void)
 {
-    lv_obj_t *discover_btn, *disconnect_btn;
+    lv_obj_t *scr = connected_scr;
+
+    lcd_create_button(scr, "VCP Discover", 160, 50, 0, 0, discover_btn_event_cb);
+    lcd_create_button(scr, "Disconnect", 120, 40, -75, -75, disconnect_btn_event_cb);
+
+    connected_msg_label = lcd_create_label(scr, "Connected.", 0, 70);
+}
 
-    lcd_clear_screen(scr);
+static void build_screens(void)
+{
+    lv_obj_t **screens[] = {&disconnected_scr, &connected_scr, &sliders_scr};
 
-    discover_btn = lcd_create_button(scr, "VCP Discover", 160, 50, 0, 0, discover_btn_event_cb);
-    disconnect_btn = lcd_create_button(scr, "Disconnect", 120, 40, -75, -75,
-                                       disconnect_btn_event_cb);
+    for (int i = 0; i < ARRAY_SIZE(screens); i++) {
+        *screens[i] = lcd_create_screen();
+        lv_obj_add_event_cb(*screens[i], scr_gesture_event_cb, LV_EVENT_GESTURE, NULL);
+    }
 
-    msg_label = lcd_create_label(scr, "Connected.", 0, 70);
+    build_disconnected_screen();
+    build_connected_screen();
+    build_sliders_screen();
 }
 
-static void create_buttons(conn_status_t all_conn)
+/* A screen shown anew starts with its initial message */
+static void show_buttons(conn_status_t all_conn)
 {
-    static bool buttons_before_connecting_created = false;
-    static bool buttons_after_connecting_created = false;
+    lv_obj_t *screen = (all_conn == conn_connected) ? connected_scr : disconnected_scr;
 
-    if (all_conn != conn_connected) {
-        if (!buttons_before_connecting_created) {
-            create_buttons_before_connecting();
-            buttons_before_connecting_created = true;
-            buttons_after_connecting_created = false;
-        }
+    if (sliders_shown) {
+        sliders_shown = false;
+        vcp_subscriptions_update();
+    }
+
+    if (lv_scr_act() == screen) {
+        return;
+    }
+
+    if (all_conn == conn_connected) {
+        msg_label = connected_msg_label;
+        lcd_display_message(msg_label, "Connected.");
     } else {
-        if(!buttons_after_connecting_created) {
-            create_buttons_after_connecting();
-            buttons_before_connecting_created = false;
-            buttons_after_connecting_created = true;
-        }
+        msg_label = disconnected_msg_label;
+        lcd_display_message(msg_label, "Not connected.");
+    }
+
+    lv_scr_load(screen);
+}
+
+static void show_scan_results(void)
+{
+    ble_scan_entry_t entries[SCAN_RESULTS_SHOWN];
+    char txt[SCAN_RESULTS_SHOWN * (MAX_DEVICE_NAME_LEN + 12) + 20];
+    int len;
+    int cnt = ble_scan_table_get(entries, ARRAY_SIZE(entries));
+
+    len = snprintf(txt, sizeof(txt), "All devices found.");
+
+    for (int i = 0; (i < cnt) && (len < sizeof(txt)); i++) {
+        len += snprintf(&txt[len], sizeof(txt) - len, "\n%s %d dBm",
+                        entries[i].name, entries[i].rssi);
     }
+
+    lcd_display_message(msg_label, txt);
 }
 
 static void scan_device_status(scan_status_t scan_st,
@@ -315,13 +560,12 @@ static void scan_device_status(scan_status_t scan_st,
     case scan_done:
         all_devices_detected = true;
         printk("All devices found.\n");
-        lcd_display_message(msg_label, "All devices found.");
+        show_scan_results();
 
         if (connect_all_targets) {
             lcd_display_message(msg_label, "Connecting...");
 
-            uint8_t first_conn_idx = 0;
-            int err = connect_first_disconnected_devic(first_conn_idx);
+            int err = connect_all_devices();
             if (err) {
                 lcd_display_message(msg_label, "Connection failed!");
             }
@@ -337,6 +581,17 @@ static void scan_device_status(scan_status_t scan_st,
     }
 }
 
+static bool any_device_connected(void)
+{
+    for (uint8_t i = 0; i < BLE_CONN_CNT; i++) {
+        if (target_device_connected[i]) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
 static void device_connection_status(uint8_t conn_idx, conn_status_t conn_st)
 {
     if (conn_idx >= BLE_CONN_CNT) {
@@ -348,29 +603,20 @@ static void device_connection_status(uint8_t conn_idx, conn_status_t conn_st)
     case conn_connected:
         target_device_connected[conn_idx] = true;
         printk("Device %d connected successfully.\n", conn_idx);
-
-        if (connect_all_targets) {
-            uint8_t next_conn = conn_idx + 1;
-            if (next_conn < BLE_CONN_CNT) {
-                if(!target_device_connected[next_conn]) {
-                    int err = connect_first_disconnected_devic(next_conn);
-                    if (err) {
-                        char txt[50];
-                        snprintf(txt, sizeof(txt), "Connection %d: failed!", next_conn);
-                        lcd_display_message(msg_label, txt);
-                        return;
-                    }
-                }
-            }
-        }
         break;
     case conn_disconnected:
         target_device_connected[conn_idx] = false;
+        target_device_vcp_discovered[conn_idx] = false;
+        group_member_leave(conn_idx);
         connect_all_targets = false;
         all_devices_detected = false;
 
         printk("Device %d disconnected successfully.\n", conn_idx);
-        create_buttons(conn_disconnected);
+
+        /* Keep controlling the remaining devices while the missing one is searched for */
+        if (!sliders_shown || !any_device_connected()) {
+            show_buttons(conn_disconnected);
+        }
         break;
     default:
         printk("Connection status value is not valid!\n");
@@ -385,15 +631,15 @@ static void device_connection_status(uint8_t conn_idx, conn_status_t conn_st)
 
     connect_all_targets = false;
     printk("All devices connected successfully.\n");
-    create_buttons(conn_connected);
+
+    /* A device rejoining the group goes straight back to the sliders */
+    if (!sliders_shown) {
+        show_buttons(conn_connected);
+    }
 }
 
 static void vcp_status(vcp_type_t cb_type, void *vcp_user_data)
 {
-#if (BLE_CONN_CNT == 2)
-    uint8_t next_conn_idx;
-#endif
-
     switch (cb_type) {
     case vcp_discover:
         vcp_discover_t *disc_data = (vcp_discover_t *)vcp_user_data;
@@ -409,27 +655,20 @@ static void vcp_status(vcp_type_t cb_type, void *vcp_user_data)
             return;
         }
 
+        /* Discovery confirming a cached layout needs no new slider screen */
+        if (target_device_vcp_discovered[disc_data->conn_idx] &&
+            (vocs_inst_cnt[disc_data->conn_idx] == disc_data->vocs_count) &&
+            (aics_inst_cnt[disc_data->conn_idx] == disc_data->aics_count)) {
+            return;
+        }
+
         vocs_inst_cnt[disc_data->conn_idx] = disc_data->vocs_count;
         aics_inst_cnt[disc_data->conn_idx] = disc_data->aics_count;
 
         target_device_vcp_discovered[disc_data->conn_idx] = true;
-        printk("Connection %d: VCP discovered successfully\n", disc_data->conn_idx);
-
-        if (vcp_discover_all_targets) {
-            uint8_t next_conn = disc_data->conn_idx + 1;
-            if (next_conn < BLE_CONN_CNT) {
-                if(!target_device_vcp_discovered[next_conn]) {
-                    int err = ble_vcp_discover(next_conn);
-                    if (err) {
-                        char txt[50];
-                        snprintf(txt, sizeof(txt), "Connection %d: VCP discover failed!",
-                                 next_conn);
-                        lcd_display_message(msg_label, txt);
-                        return;
-                    }
-                }
-            }
-        }
+        group_member_join(disc_data->conn_idx, disc_data->vocs_count, disc_data->aics_count);
+        printk("Connection %d: VCP %s successfully\n", disc_data->conn_idx,
+               disc_data->cached ? "layout restored from cache" : "discovered");
 
         for (uint8_t i = 0; i < BLE_CONN_CNT; i++) {
             if (!target_device_vcp_discovered[i]) {
@@ -438,7 +677,9 @@ static void vcp_status(vcp_type_t cb_type, void *vcp_user_data)
         }
 
         printk("VCP discovered for all devices successfully.\n");
-        create_sliders();
+
+        /* A device rejoining the group gets its values from the notifications that follow */
+        show_sliders();
         break;
     case vcp_vcs_vol_state:
         vcp_vol_state_t *vcs_state = (vcp_vol_state_t *)vcp_user_data;
@@ -456,24 +697,8 @@ static void vcp_status(vcp_type_t cb_type, void *vcp_user_data)
         printk("Connection %d: VCS volume = %u, mute = %u\n",
                vcs_state->conn_idx, vcs_state->volume, vcs_state->mute);
 
-#if (BLE_CONN_CNT == 2)
-        next_conn_idx = (vcs_state->conn_idx != conn_rshi) ? conn_rshi : conn_lshi;
-
-        if (vcs_volume_changed || (vcs_volume != vcs_state->volume)) {
-            ble_update_volume(next_conn_idx, vcs_state->volume);
-            vcs_volume_changed = false;
-        }
-
-        if (vcs_mute_changed || (vcs_mute != vcs_state->mute)) {
-            ble_update_volume_mute(next_conn_idx, vcs_state->mute);
-            vcs_mute_changed = false;
-        }
-#endif
-        vcs_volume = vcs_state->volume;
-        vcs_mute = vcs_state->mute;
-
-        lv_slider_set_value(vcs_volume_slider, vcs_volume, LV_ANIM_OFF);
-        lcd_change_voice_icon(vcs_voice_icon, vcs_mute);
+        group_report(group_vcs_volume, vcs_state->conn_idx, 0, vcs_state->volume);
+        group_report(group_vcs_mute, vcs_state->conn_idx, 0, vcs_state->mute);
         break;
     case vcp_vocs_state:
         vcp_vocs_state_t *vocs_state = (vcp_vocs_state_t *)vcp_user_data;
@@ -497,24 +722,8 @@ static void vcp_status(vcp_type_t cb_type, void *vcp_user_data)
         printk("Connection %d: VOCS-%d offset = %d\n",
                vocs_state->conn_idx, vocs_state->inst_idx, vocs_state->offset);
 
-#if (BLE_CONN_CNT == 1)
-        vocs_offset[vocs_state->inst_idx] = vocs_state->offset;
-#elif (BLE_CONN_CNT == 2)
-        int16_t new_offset = (vocs_state->conn_idx != conn_rshi) ?
-                             -(vocs_state->offset) : vocs_state->offset;
-
-        next_conn_idx = (vocs_state->conn_idx != conn_rshi) ? conn_rshi : conn_lshi;
-
-        if (vocs_offset_changed || (vocs_offset[vocs_state->inst_idx] != new_offset)) {
-            ble_update_vocs_offset(next_conn_idx, vocs_state->inst_idx, -(vocs_state->offset));
-            vocs_offset_changed = false;
-        }
-
-        vocs_offset[vocs_state->inst_idx] = new_offset;
-#endif
-        lv_slider_set_value(vocs_slider[vocs_state->inst_idx],
-                            vocs_offset[vocs_state->inst_idx],
-                            LV_ANIM_OFF);
+        group_report(group_vocs_offset, vocs_state->conn_idx, vocs_state->inst_idx,
+                     vocs_state->offset);
         break;
     case vcp_aics_state:
         vcp_aics_state_t *aics_state = (vcp_aics_state_t *)vcp_user_data;
@@ -539,31 +748,277 @@ static void vcp_status(vcp_type_t cb_type, void *vcp_user_data)
                aics_state->conn_idx, aics_state->inst_idx,
                aics_state->gain, aics_state->mute, aics_state->mode);
 
-#if (BLE_CONN_CNT == 2)
-        next_conn_idx = (aics_state->conn_idx != conn_rshi) ? conn_rshi : conn_lshi;
+        group_report(group_aics_gain, aics_state->conn_idx, aics_state->inst_idx,
+                     aics_state->gain);
+        group_report(group_aics_mute, aics_state->conn_idx, aics_state->inst_idx,
+                     aics_state->mute);
+        break;
+    default:
+        printk("VCP status: undefined parameter!\n");
+        break;
+    }
+}
 
-        if (aics_gain_changed || (aics_gain[aics_state->inst_idx] != aics_state->gain)) {
-            ble_update_aics_gain(next_conn_idx, aics_state->inst_idx, aics_state->gain);
-            aics_gain_changed = false;
+static void collapse_vcp_state(const ui_evt_t *evt)
+{
+    uint8_t conn_idx;
+    uint8_t inst_idx;
+
+    switch (evt->vcp.type) {
+    case vcp_vcs_vol_state:
+        conn_idx = evt->vcp.vol_state.conn_idx;
+        if (conn_idx >= BLE_CONN_CNT) {
+            return;
         }
 
-        if (aics_mute_changed || (aics_mute[aics_state->inst_idx] != aics_state->mute)) {
-            ble_update_aics_mute(next_conn_idx, aics_state->inst_idx, aics_state->mute);
-            aics_mute_changed = false;
+        pending_vol_state[conn_idx] = evt->vcp.vol_state;
+        pending_vol_valid[conn_idx] = true;
+        break;
+    case vcp_vocs_state:
+        conn_idx = evt->vcp.vocs_state.conn_idx;
+        inst_idx = evt->vcp.vocs_state.inst_idx;
+        if ((conn_idx >= BLE_CONN_CNT) || (inst_idx >= VCP_MAX_VOCS_INST)) {
+            return;
         }
-#endif
-        aics_gain[aics_state->inst_idx] = aics_state->gain;
-        aics_mute[aics_state->inst_idx] = aics_state->mute;
-
-        lv_slider_set_value(aics_slider[aics_state->inst_idx],
-                            aics_gain[aics_state->inst_idx],
-                            LV_ANIM_OFF);
-        lcd_change_voice_icon(aics_voice_icon[aics_state->inst_idx],
-                              aics_mute[aics_state->inst_idx]);
+
+        pending_vocs_state[conn_idx][inst_idx] = evt->vcp.vocs_state;
+        pending_vocs_valid[conn_idx][inst_idx] = true;
+        break;
+    case vcp_aics_state:
+        conn_idx = evt->vcp.aics_state.conn_idx;
+        inst_idx = evt->vcp.aics_state.inst_idx;
+        if ((conn_idx >= BLE_CONN_CNT) || (inst_idx >= VCP_MAX_AICS_INST)) {
+            return;
+        }
+
+        pending_aics_state[conn_idx][inst_idx] = evt->vcp.aics_state;
+        pending_aics_valid[conn_idx][inst_idx] = true;
+        break;
+    default:
+        return;
+    }
+
+    pending_states = true;
+}
+
+static void apply_pending_vcp_states(void)
+{
+    if (!pending_states) {
+        return;
+    }
+
+    pending_states = false;
+
+    for (uint8_t i = 0; i < BLE_CONN_CNT; i++) {
+        if (pending_vol_valid[i]) {
+            pending_vol_valid[i] = false;
+            vcp_status(vcp_vcs_vol_state, &pending_vol_state[i]);
+        }
+
+        for (uint8_t j = 0; j < VCP_MAX_VOCS_INST; j++) {
+            if (pending_vocs_valid[i][j]) {
+                pending_vocs_valid[i][j] = false;
+                vcp_status(vcp_vocs_state, &pending_vocs_state[i][j]);
+            }
+        }
+
+        for (uint8_t j = 0; j < VCP_MAX_AICS_INST; j++) {
+            if (pending_aics_valid[i][j]) {
+                pending_aics_valid[i][j] = false;
+                vcp_status(vcp_aics_state, &pending_aics_state[i][j]);
+            }
+        }
+    }
+
+    /* The widgets follow the group state once per frame, however many reports came in */
+    ui_bind_refresh();
+}
+
+/* All steps of a frame go out as one group step, presses in opposite directions cancel */
+static void apply_pending_vol_steps(void)
+{
+    int8_t steps = CLAMP(pending_vol_steps, INT8_MIN, INT8_MAX);
+
+    if (steps == 0) {
+        return;
+    }
+
+    pending_vol_steps -= steps;
+    group_step(group_vcs_volume, steps);
+}
+
+/*
+ * Drain the event queue once per frame. State notifications are collapsed to
+ * the latest value per widget, while scan, connection and discovery events are
+ * handled in order, after any state received before them has been applied.
+ */
+static void process_ui_events(void)
+{
+    ui_evt_t evt;
+
+    for (int n = 0; (n < UI_EVT_QUEUE_SIZE) && ui_evt_get(&evt); n++) {
+        switch (evt.type) {
+        case ui_evt_scan_status:
+            apply_pending_vcp_states();
+            scan_device_status(evt.scan.status, evt.scan.dev_name);
+            break;
+        case ui_evt_conn_status:
+            apply_pending_vcp_states();
+            device_connection_status(evt.conn.conn_idx, evt.conn.status);
+            break;
+        case ui_evt_vcp_status:
+            if (evt.vcp.type != vcp_discover) {
+                collapse_vcp_state(&evt);
+                break;
+            }
+
+            apply_pending_vcp_states();
+            vcp_status(vcp_discover, &evt.vcp.discover);
+            break;
+        case ui_evt_vol_step:
+            pending_vol_steps += evt.step.steps;
+            break;
+        default:
+            printk("UI event: undefined type!\n");
+            break;
+        }
+    }
+
+    apply_pending_vcp_states();
+    apply_pending_vol_steps();
+}
+
+static void post_scan_status(scan_status_t scan_st, const char *dev_name)
+{
+    ui_evt_t evt = {
+        .type = ui_evt_scan_status,
+        .scan.status = scan_st,
+    };
+
+    if (dev_name) {
+        strncpy(evt.scan.dev_name, dev_name, sizeof(evt.scan.dev_name) - 1);
+    }
+
+    ui_evt_post(&evt);
+}
+
+static void post_conn_status(uint8_t conn_idx, conn_status_t conn_st)
+{
+    ui_evt_t evt = {
+        .type = ui_evt_conn_status,
+        .conn.conn_idx = conn_idx,
+        .conn.status = conn_st,
+    };
+
+    ui_evt_post(&evt);
+}
+
+static void post_vcp_status(vcp_type_t cb_type, void *vcp_user_data)
+{
+    ui_evt_t evt = {
+        .type = ui_evt_vcp_status,
+        .vcp.type = cb_type,
+    };
+
+    switch (cb_type) {
+    case vcp_discover:
+        evt.vcp.discover = *(vcp_discover_t *)vcp_user_data;
+        break;
+    case vcp_vcs_vol_state:
+        evt.vcp.vol_state = *(vcp_vol_state_t *)vcp_user_data;
+        break;
+    case vcp_vocs_state:
+        evt.vcp.vocs_state = *(vcp_vocs_state_t *)vcp_user_data;
+        break;
+    case vcp_aics_state:
+        evt.vcp.aics_state = *(vcp_aics_state_t *)vcp_user_data;
         break;
     default:
         printk("VCP status: undefined parameter!\n");
+        return;
+    }
+
+    ui_evt_post(&evt);
+}
+
+/*
+ * Called from the input thread for every input device. Volume keys are handed
+ * over to the UI thread as steps, any other input (touch) only wakes it.
+ */
+static void input_cb(struct input_event *evt)
+{
+    ui_evt_t ui_evt = {
+        .type = ui_evt_vol_step,
+    };
+
+    if (evt->type != INPUT_EV_KEY) {
+        atomic_set(&touch_activity, 1);
+        ui_evt_wake();
+        return;
+    }
+
+    if (!evt->value) {
+        return;
+    }
+
+    switch (evt->code) {
+    case INPUT_KEY_VOLUMEUP:
+        ui_evt.step.steps = 1;
+        break;
+    case INPUT_KEY_VOLUMEDOWN:
+        ui_evt.step.steps = -1;
         break;
+    default:
+        return;
+    }
+
+    ui_evt_post(&ui_evt);
+}
+
+INPUT_CALLBACK_DEFINE(NULL, input_cb);
+
+static void touch_polling_set(bool on)
+{
+    lv_indev_t *indev = NULL;
+
+    while ((indev = lv_indev_get_next(indev)) != NULL) {
+        if (on) {
+            lv_timer_resume(indev->driver->read_timer);
+            lv_timer_ready(indev->driver->read_timer);
+        } else {
+            lv_timer_pause(indev->driver->read_timer);
+        }
+    }
+
+    touch_polling = on;
+}
+
+static bool touch_pressed(void)
+{
+    lv_indev_t *indev = NULL;
+
+    while ((indev = lv_indev_get_next(indev)) != NULL) {
+        if (indev->proc.state == LV_INDEV_STATE_PRESSED) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+/* Resume polling on a touch, stop it once the screen has been released for a while */
+static void touch_polling_update(void)
+{
+    uint32_t now = k_uptime_get_32();
+
+    if (atomic_clear(&touch_activity)) {
+        touch_last_ms = now;
+
+        if (!touch_polling) {
+            touch_polling_set(true);
+        }
+    } else if (touch_polling && ((now - touch_last_ms) >= UI_INPUT_IDLE_MS) && !touch_pressed()) {
+        touch_polling_set(false);
     }
 }
 
@@ -573,19 +1028,54 @@ static int bt_init(void)
 
     err = ble_bt_init();
     if (!err) {
-        ble_scan_status_cb_register(&scan_device_status);
-        ble_conn_status_cb_register(&device_connection_status);
-        ble_vcp_status_cb_register(&vcp_status);
+        ble_scan_status_cb_register(&post_scan_status);
+        ble_conn_status_cb_register(&post_conn_status);
+        ble_vcp_status_cb_register(&post_vcp_status);
     }
 
     return err;
 }
 
+#if defined(CONFIG_SHELL)
+/* Root of the application shell commands, modules add their own subcommands */
+SHELL_SUBCMD_SET_CREATE(vcpc_cmds, (vcpc));
+SHELL_CMD_REGISTER(vcpc, &vcpc_cmds, "VCP central commands", NULL);
+
+static int ui_stats_shell(const struct shell *sh, size_t argc, char **argv)
+{
+    uint32_t uptime_s = MAX(k_uptime_get_32() / 1000U, 1U);
+    ui_bind_stats_t bind_stats;
+    uint8_t bound = 0;
+
+    shell_print(sh, "UI wakeups: %u by events or input, %u by LVGL timers (%u per s)",
+                ui_wakeups_evt, ui_wakeups_timer, (ui_wakeups_evt + ui_wakeups_timer) / uptime_s);
+    shell_print(sh, "Touch polling %s, %u UI event(s) dropped", touch_polling ? "on" : "off",
+                ui_evt_dropped_count());
+
+    for (uint8_t i = 0; i < SLIDER_ROWS_POOL; i++) {
+        bound += (slider_rows[i].row_idx >= 0) ? 1 : 0;
+    }
+
+    shell_print(sh, "Slider rows: %u of %u bound to widgets, pool of %u, %u rebound", bound,
+                slider_row_cnt(), SLIDER_ROWS_POOL, slider_rows_rebound);
+
+    ui_bind_stats_get(&bind_stats);
+    shell_print(sh, "Widget updates: %u written, %u skipped as unchanged",
+                bind_stats.updated, bind_stats.unchanged);
+
+    return 0;
+}
+
+SHELL_SUBCMD_ADD((vcpc), ui, NULL, "Show UI thread wakeups", ui_stats_shell, 1, 0);
+#endif
+
 
 int main(void)
 {
     int err;
 
+    group_init();
+
     err = bt_init();
     if(err) {
         printk("BT init failed!\n");
@@ -593,8 +1083,6 @@ int main(void)
     }
     printk("BT initialized.\n");
 
-    scr = lv_scr_act();
-
     err = lcd_init();
     if (err) {
         printk("Device not ready!\n");
@@ -602,10 +1090,27 @@ int main(void)
     }
     printk("Display initialized.\n");
 
-    create_buttons(conn_disconnected);
+    build_screens();
+    show_buttons(conn_disconnected);
+
+    if (ble_auto_connect_start() > 0) {
+        lcd_display_message(msg_label, "Reconnecting...");
+    }
 
+    /* Sleep until the next LVGL timer is due or an event or touch arrives */
     while (1) {
-        lv_task_handler();
-        k_sleep(K_MSEC(50));
+        touch_polling_update();
+        process_ui_events();
+
+        uint32_t idle_ms = lv_task_handler();
+
+        /* Swipes are recognized within the timer handler */
+        apply_pending_vol_steps();
+
+        if (ui_evt_wait((idle_ms == LV_NO_TIMER_READY) ? K_FOREVER : K_MSEC(idle_ms))) {
+            ui_wakeups_evt++;
+        } else {
+            ui_wakeups_timer++;
+        }
     }
 }
@@ -0,0 +1,243 @@
+/*
+ * Copyright (c) 2024 Demant A/S
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+/* Per-device mix persistence
+ *
+ * Keeps the last value confirmed by each bonded device for every group
+ * control, so that a reconnecting device is shown with its mix on the first
+ * frame, before any notification has arrived. Entries belong to the peer
+ * bonded on the slot and are dropped when another peer is bonded there. The
+ * bonded address is looked up once when a member joins, not on every report.
+ *
+ * Changes are collected in RAM and written to the settings behind: the first
+ * change after a save schedules the next one MIX_SAVE_DELAY_MS later, and all
+ * changes until then go out with it. Dragging a slider costs at most one
+ * flash write per device and period.
+ */
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <zephyr/kernel.h>
+#include <zephyr/sys/printk.h>
+#include <zephyr/settings/settings.h>
+#include <zephyr/shell/shell.h>
+#include <zephyr/bluetooth/bluetooth.h>
+
+#include "mix.h"
+#include "ble_bond.h"
+
+
+#define MIX_SETTINGS_KEY    "vcpc/mix"
+
+struct mix_entry {
+    bt_addr_le_t addr;
+    /* Controls with a stored value */
+    uint32_t valid;
+    int16_t value[GROUP_CTRL_CNT];
+};
+
+BUILD_ASSERT(GROUP_CTRL_CNT <= 32, "Valid masks hold up to 32 controls");
+
+static struct mix_entry mix_entries[BLE_CONN_CNT];
+static uint32_t mix_dirty;
+
+/* Bonded address of each connected member, valid while its bit is set */
+static bt_addr_le_t mix_peers[BLE_CONN_CNT];
+static uint32_t mix_peers_valid;
+static mix_stats_t stats;
+
+static struct k_spinlock mix_lock;
+
+static void mix_save_handler(struct k_work *work);
+static K_WORK_DELAYABLE_DEFINE(mix_save_work, mix_save_handler);
+
+
+static int mix_settings_set(const char *name, size_t len, settings_read_cb read_cb,
+                            void *cb_arg)
+{
+    char *end;
+    unsigned long slot = strtoul(name, &end, 10);
+
+    if ((end == name) || (*end != '\0') || (slot >= BLE_CONN_CNT)) {
+        return -ENOENT;
+    }
+
+    /* Entries of another control layout are of no use */
+    if (len != sizeof(mix_entries[slot])) {
+        return -EINVAL;
+    }
+
+    ssize_t rc = read_cb(cb_arg, &mix_entries[slot], sizeof(mix_entries[slot]));
+    if (rc < 0) {
+        return rc;
+    }
+
+    return 0;
+}
+
+SETTINGS_STATIC_HANDLER_DEFINE(vcpc_mix, MIX_SETTINGS_KEY, NULL, mix_settings_set,
+                               NULL, NULL);
+
+static void mix_save_handler(struct k_work *work)
+{
+    char key[sizeof(MIX_SETTINGS_KEY) + 4];
+    struct mix_entry entry;
+
+    for (uint8_t i = 0; i < BLE_CONN_CNT; i++) {
+        k_spinlock_key_t lock_key = k_spin_lock(&mix_lock);
+
+        if (!(mix_dirty & BIT(i))) {
+            k_spin_unlock(&mix_lock, lock_key);
+            continue;
+        }
+
+        mix_dirty &= ~BIT(i);
+        entry = mix_entries[i];
+        stats.saves++;
+        k_spin_unlock(&mix_lock, lock_key);
+
+        snprintk(key, sizeof(key), MIX_SETTINGS_KEY "/%u", i);
+
+        int err = settings_save_one(key, &entry, sizeof(entry));
+        if (err) {
+            printk("Connection %d: storing mix failed (err %d)\n", i, err);
+        }
+    }
+}
+
+/* Binds the slot to the peer bonded on it, only the mix of bonded devices is kept */
+void mix_member_bind(uint8_t conn_idx)
+{
+    bt_addr_le_t addr;
+
+    if (conn_idx >= BLE_CONN_CNT) {
+        return;
+    }
+
+    bool bonded = ble_bond_get(conn_idx, &addr);
+
+    k_spinlock_key_t key = k_spin_lock(&mix_lock);
+
+    if (bonded) {
+        bt_addr_le_copy(&mix_peers[conn_idx], &addr);
+        mix_peers_valid |= BIT(conn_idx);
+    } else {
+        mix_peers_valid &= ~BIT(conn_idx);
+    }
+
+    k_spin_unlock(&mix_lock, key);
+}
+
+void mix_member_unbind(uint8_t conn_idx)
+{
+    if (conn_idx >= BLE_CONN_CNT) {
+        return;
+    }
+
+    k_spinlock_key_t key = k_spin_lock(&mix_lock);
+    mix_peers_valid &= ~BIT(conn_idx);
+    k_spin_unlock(&mix_lock, key);
+}
+
+/* Takes the member value of a control, as confirmed by the device */
+void mix_store(uint8_t conn_idx, uint8_t ctrl_idx, int16_t value)
+{
+    if ((conn_idx >= BLE_CONN_CNT) || (ctrl_idx >= GROUP_CTRL_CNT)) {
+        return;
+    }
+
+    k_spinlock_key_t key = k_spin_lock(&mix_lock);
+    struct mix_entry *entry = &mix_entries[conn_idx];
+    const bt_addr_le_t *addr = &mix_peers[conn_idx];
+
+    if (!(mix_peers_valid & BIT(conn_idx))) {
+        k_spin_unlock(&mix_lock, key);
+        return;
+    }
+
+    if (!bt_addr_le_eq(&entry->addr, addr)) {
+        memset(entry, 0, sizeof(*entry));
+        bt_addr_le_copy(&entry->addr, addr);
+    }
+
+    if ((entry->valid & BIT(ctrl_idx)) && (entry->value[ctrl_idx] == value)) {
+        k_spin_unlock(&mix_lock, key);
+        return;
+    }
+
+    entry->value[ctrl_idx] = value;
+    entry->valid |= BIT(ctrl_idx);
+    mix_dirty |= BIT(conn_idx);
+    stats.updates++;
+
+    k_spin_unlock(&mix_lock, key);
+
+    /* Not rescheduled, so later changes do not postpone the save */
+    k_work_schedule(&mix_save_work, K_MSEC(MIX_SAVE_DELAY_MS));
+}
+
+bool mix_get(uint8_t conn_idx, uint8_t ctrl_idx, int16_t *value)
+{
+    bool found;
+
+    if ((conn_idx >= BLE_CONN_CNT) || (ctrl_idx >= GROUP_CTRL_CNT)) {
+        return false;
+    }
+
+    k_spinlock_key_t key = k_spin_lock(&mix_lock);
+    const struct mix_entry *entry = &mix_entries[conn_idx];
+
+    found = (mix_peers_valid & BIT(conn_idx)) &&
+            bt_addr_le_eq(&entry->addr, &mix_peers[conn_idx]) && (entry->valid & BIT(ctrl_idx));
+
+    if (found) {
+        *value = entry->value[ctrl_idx];
+    }
+
+    k_spin_unlock(&mix_lock, key);
+
+    return found;
+}
+
+void mix_stats_get(mix_stats_t *mix_stats)
+{
+    k_spinlock_key_t key = k_spin_lock(&mix_lock);
+    *mix_stats = stats;
+    k_spin_unlock(&mix_lock, key);
+}
+
+#if defined(CONFIG_SHELL)
+static int mix_shell(const struct shell *sh, size_t argc, char **argv)
+{
+    mix_stats_t mix_stats;
+    uint32_t dirty;
+    uint32_t valid[BLE_CONN_CNT];
+
+    k_spinlock_key_t key = k_spin_lock(&mix_lock);
+
+    mix_stats = stats;
+    dirty = mix_dirty;
+
+    for (uint8_t i = 0; i < BLE_CONN_CNT; i++) {
+        valid[i] = mix_entries[i].valid;
+    }
+
+    k_spin_unlock(&mix_lock, key);
+
+    shell_print(sh, "%u change(s) stored with %u settings write(s)", mix_stats.updates,
+                mix_stats.saves);
+
+    for (uint8_t i = 0; i < BLE_CONN_CNT; i++) {
+        shell_print(sh, "Connection %d: %u of %u control(s) stored%s", i,
+                    (uint32_t)__builtin_popcount(valid[i]), GROUP_CTRL_CNT,
+                    (dirty & BIT(i)) ? ", save pending" : "");
+    }
+
+    return 0;
+}
+
+SHELL_SUBCMD_ADD((vcpc), mix, NULL, "Show the stored mix of each device", mix_shell, 1, 0);
+#endif
@@ -0,0 +1,30 @@
+/*
+ * Copyright (c) 2024 Demant A/S
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+/* Header for the per-device mix persistence */
+
+#ifndef __MIX_H
+#define __MIX_H
+
+#include "group.h"
+
+#define MIX_SAVE_DELAY_MS   CONFIG_MIX_SAVE_DELAY_MS
+
+
+typedef struct
+{
+    /* Values changed and settings writes they were saved with */
+    uint32_t updates;
+    uint32_t saves;
+} mix_stats_t;
+
+
+void mix_member_bind(uint8_t conn_idx);
+void mix_member_unbind(uint8_t conn_idx);
+void mix_store(uint8_t conn_idx, uint8_t ctrl_idx, int16_t value);
+bool mix_get(uint8_t conn_idx, uint8_t ctrl_idx, int16_t *value);
+void mix_stats_get(mix_stats_t *mix_stats);
+
+#endif /* __MIX_H */
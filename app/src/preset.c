@@ -0,0 +1,219 @@
+/*
+ * Copyright (c) 2024 Demant A/S
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+/* Named mix presets
+ *
+ * A preset holds the group state: volume, mute, every VOCS offset and every
+ * AICS gain and mute. Saving takes the desired state of the group as it is,
+ * recalling hands it back to the group in one call, which writes only what
+ * differs and queues all writes as one batch across the devices. The group
+ * reports when the last device confirmed its part.
+ *
+ * Presets are stored in the settings right away, they change rarely.
+ */
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <zephyr/kernel.h>
+#include <zephyr/sys/printk.h>
+#include <zephyr/settings/settings.h>
+#include <zephyr/shell/shell.h>
+
+#include "preset.h"
+#include "group.h"
+
+
+#define PRESET_SETTINGS_KEY "vcpc/preset"
+
+struct preset_entry {
+    char name[PRESET_NAME_LEN];
+    /* Controls the preset has a value for, none for an empty preset */
+    uint32_t valid;
+    int16_t value[GROUP_CTRL_CNT];
+};
+
+static struct preset_entry presets[PRESET_CNT];
+
+static struct k_spinlock preset_lock;
+
+
+static int preset_settings_set(const char *name, size_t len, settings_read_cb read_cb,
+                               void *cb_arg)
+{
+    char *end;
+    unsigned long idx = strtoul(name, &end, 10);
+
+    if ((end == name) || (*end != '\0') || (idx >= PRESET_CNT)) {
+        return -ENOENT;
+    }
+
+    /* Presets of another control layout are of no use */
+    if (len != sizeof(presets[idx])) {
+        return -EINVAL;
+    }
+
+    ssize_t rc = read_cb(cb_arg, &presets[idx], sizeof(presets[idx]));
+    if (rc < 0) {
+        return rc;
+    }
+
+    presets[idx].name[PRESET_NAME_LEN - 1] = '\0';
+
+    return 0;
+}
+
+SETTINGS_STATIC_HANDLER_DEFINE(vcpc_preset, PRESET_SETTINGS_KEY, NULL, preset_settings_set,
+                               NULL, NULL);
+
+/* Takes the current group state, keeps the name of the preset without one given */
+int preset_save(uint8_t idx, const char *name)
+{
+    char key[sizeof(PRESET_SETTINGS_KEY) + 4];
+    struct preset_entry entry;
+
+    if (idx >= PRESET_CNT) {
+        return -EINVAL;
+    }
+
+    entry.valid = group_state_get(entry.value);
+    if (!entry.valid) {
+        /* Nothing connected has reported yet */
+        return -ENODATA;
+    }
+
+    k_spinlock_key_t lock_key = k_spin_lock(&preset_lock);
+
+    if (name) {
+        strncpy(entry.name, name, PRESET_NAME_LEN - 1);
+        entry.name[PRESET_NAME_LEN - 1] = '\0';
+    } else if (presets[idx].valid) {
+        memcpy(entry.name, presets[idx].name, PRESET_NAME_LEN);
+    } else {
+        snprintk(entry.name, PRESET_NAME_LEN, "P%u", idx + 1);
+    }
+
+    presets[idx] = entry;
+
+    k_spin_unlock(&preset_lock, lock_key);
+
+    snprintk(key, sizeof(key), PRESET_SETTINGS_KEY "/%u", idx);
+
+    int err = settings_save_one(key, &entry, sizeof(entry));
+    if (err) {
+        printk("Preset %u: storing failed (err %d)\n", idx, err);
+    }
+
+    return err;
+}
+
+/* Returns the number of writes issued to bring the group to the preset */
+int preset_recall(uint8_t idx)
+{
+    struct preset_entry entry;
+
+    if (idx >= PRESET_CNT) {
+        return -EINVAL;
+    }
+
+    k_spinlock_key_t key = k_spin_lock(&preset_lock);
+    entry = presets[idx];
+    k_spin_unlock(&preset_lock, key);
+
+    if (!entry.valid) {
+        return -ENOENT;
+    }
+
+    return group_state_apply(entry.value, entry.valid);
+}
+
+bool preset_valid(uint8_t idx)
+{
+    bool valid;
+
+    if (idx >= PRESET_CNT) {
+        return false;
+    }
+
+    k_spinlock_key_t key = k_spin_lock(&preset_lock);
+    valid = (presets[idx].valid != 0);
+    k_spin_unlock(&preset_lock, key);
+
+    return valid;
+}
+
+void preset_name(uint8_t idx, char name[PRESET_NAME_LEN])
+{
+    if (idx >= PRESET_CNT) {
+        name[0] = '\0';
+        return;
+    }
+
+    k_spinlock_key_t key = k_spin_lock(&preset_lock);
+
+    if (presets[idx].valid) {
+        memcpy(name, presets[idx].name, PRESET_NAME_LEN);
+    } else {
+        snprintk(name, PRESET_NAME_LEN, "P%u", idx + 1);
+    }
+
+    k_spin_unlock(&preset_lock, key);
+}
+
+#if defined(CONFIG_SHELL)
+static int preset_shell(const struct shell *sh, size_t argc, char **argv)
+{
+    char name[PRESET_NAME_LEN];
+    unsigned long idx;
+    char *end;
+    int ret;
+
+    if (argc == 1) {
+        for (uint8_t i = 0; i < PRESET_CNT; i++) {
+            preset_name(i, name);
+            shell_print(sh, "Preset %u: %s%s", i, name, preset_valid(i) ? "" : " (empty)");
+        }
+
+        return 0;
+    }
+
+    if (argc < 3) {
+        shell_error(sh, "Usage: preset [save <n> [name] | recall <n>]");
+        return -EINVAL;
+    }
+
+    idx = strtoul(argv[2], &end, 10);
+    if ((end == argv[2]) || (*end != '\0') || (idx >= PRESET_CNT)) {
+        shell_error(sh, "Preset number 0 to %u expected", PRESET_CNT - 1);
+        return -EINVAL;
+    }
+
+    if (strcmp(argv[1], "save") == 0) {
+        ret = preset_save(idx, (argc > 3) ? argv[3] : NULL);
+        if (ret) {
+            shell_error(sh, "Saving preset %lu failed (err %d)", idx, ret);
+        }
+
+        return ret;
+    }
+
+    if (strcmp(argv[1], "recall") == 0) {
+        ret = preset_recall(idx);
+        if (ret < 0) {
+            shell_error(sh, "Recalling preset %lu failed (err %d)", idx, ret);
+            return ret;
+        }
+
+        shell_print(sh, "Preset %lu: %d write(s) issued", idx, ret);
+        return 0;
+    }
+
+    shell_error(sh, "Unknown action %s", argv[1]);
+    return -EINVAL;
+}
+
+SHELL_SUBCMD_ADD((vcpc), preset, NULL, "List, save or recall the mix presets of the group",
+                 preset_shell, 1, 3);
+#endif
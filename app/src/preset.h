@@ -0,0 +1,23 @@
+/*
+ * Copyright (c) 2024 Demant A/S
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+/* Header for the named mix presets of the group */
+
+#ifndef __PRESET_H
+#define __PRESET_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#define PRESET_CNT          CONFIG_PRESET_COUNT
+#define PRESET_NAME_LEN     16
+
+
+int preset_save(uint8_t idx, const char *name);
+int preset_recall(uint8_t idx);
+bool preset_valid(uint8_t idx);
+void preset_name(uint8_t idx, char name[PRESET_NAME_LEN]);
+
+#endif /* __PRESET_H */
@@ -0,0 +1,134 @@
+/*
+ * Copyright (c) 2024 Demant A/S
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+/* Group state to widget binding
+ *
+ * Every widget showing a group control is bound to it together with the value
+ * it currently shows. A refresh compares the group state with the shown
+ * values and only writes the widgets whose value changed, so repeated or
+ * echoed notifications do not invalidate any part of the screen.
+ *
+ * Widgets recycled for another control are bound again and get the value of
+ * the new control on the next refresh.
+ *
+ * Bindings are only used from the UI thread.
+ */
+
+#include <errno.h>
+#include <zephyr/kernel.h>
+#include <zephyr/sys/printk.h>
+
+#include "ui_bind.h"
+#include "lcd.h"
+
+
+struct ui_binding {
+    lv_obj_t *obj;
+    ui_bind_kind_t kind;
+    group_ctrl_t ctrl;
+    uint8_t inst_idx;
+    int16_t shown;
+    bool shown_valid;
+};
+
+static struct ui_binding bindings[UI_BIND_MAX];
+static uint8_t binding_cnt;
+static ui_bind_stats_t stats;
+
+
+/* Returns false if the widget could not take the value yet */
+static bool ui_bind_apply(struct ui_binding *binding, int16_t value)
+{
+    switch (binding->kind) {
+    case ui_bind_slider:
+        /* A knob held by the user is updated once it is released */
+        if (lv_obj_has_state(binding->obj, LV_STATE_PRESSED)) {
+            return false;
+        }
+
+        /* A knob released by the user already shows the value it set */
+        if (lv_slider_get_value(binding->obj) == value) {
+            stats.unchanged++;
+            return true;
+        }
+
+        lcd_update_slider(binding->obj, value);
+        break;
+    case ui_bind_mute_icon:
+        lcd_change_voice_icon(binding->obj, value);
+        break;
+    default:
+        return false;
+    }
+
+    stats.updated++;
+    return true;
+}
+
+static struct ui_binding *ui_bind_find(lv_obj_t *obj)
+{
+    for (uint8_t i = 0; i < binding_cnt; i++) {
+        if (bindings[i].obj == obj) {
+            return &bindings[i];
+        }
+    }
+
+    return NULL;
+}
+
+int ui_bind_add(lv_obj_t *obj, ui_bind_kind_t kind, group_ctrl_t ctrl, uint8_t inst_idx)
+{
+    struct ui_binding *binding = ui_bind_find(obj);
+
+    if (binding == NULL) {
+        if (binding_cnt >= UI_BIND_MAX) {
+            printk("UI binding table full!\n");
+            return -ENOMEM;
+        }
+
+        binding = &bindings[binding_cnt++];
+    }
+
+    *binding = (struct ui_binding) {
+        .obj = obj,
+        .kind = kind,
+        .ctrl = ctrl,
+        .inst_idx = inst_idx,
+    };
+
+    return 0;
+}
+
+void ui_bind_remove(lv_obj_t *obj)
+{
+    struct ui_binding *binding = ui_bind_find(obj);
+
+    if (binding != NULL) {
+        *binding = bindings[--binding_cnt];
+    }
+}
+
+void ui_bind_refresh(void)
+{
+    for (uint8_t i = 0; i < binding_cnt; i++) {
+        struct ui_binding *binding = &bindings[i];
+        int16_t value = group_get(binding->ctrl, binding->inst_idx);
+
+        if (binding->shown_valid && (binding->shown == value)) {
+            stats.unchanged++;
+            continue;
+        }
+
+        if (ui_bind_apply(binding, value)) {
+            binding->shown = value;
+            binding->shown_valid = true;
+        }
+    }
+}
+
+void ui_bind_stats_get(ui_bind_stats_t *ui_bind_stats)
+{
+    *ui_bind_stats = stats;
+}
@@ -0,0 +1,38 @@
+/*
+ * Copyright (c) 2024 Demant A/S
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+/* Header for the group state to widget binding */
+
+#ifndef __UI_BIND_H
+#define __UI_BIND_H
+
+#include <lvgl.h>
+
+#include "group.h"
+
+/* Widgets bound at a time, only the widgets on screen are bound */
+#define UI_BIND_MAX     16
+
+
+typedef enum
+{
+    ui_bind_slider,
+    ui_bind_mute_icon,
+} ui_bind_kind_t;
+
+typedef struct
+{
+    /* Widgets written and refreshes that left a widget untouched */
+    uint32_t updated;
+    uint32_t unchanged;
+} ui_bind_stats_t;
+
+
+int ui_bind_add(lv_obj_t *obj, ui_bind_kind_t kind, group_ctrl_t ctrl, uint8_t inst_idx);
+void ui_bind_remove(lv_obj_t *obj);
+void ui_bind_refresh(void);
+void ui_bind_stats_get(ui_bind_stats_t *stats);
+
+#endif /* __UI_BIND_H */
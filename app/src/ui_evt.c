@@ -0,0 +1,94 @@
+/*
+ * Copyright (c) 2024 Demant A/S
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+/* Bluetooth to UI event queue
+ *
+ * Single consumer ring buffer carrying fixed-size events from the Bluetooth
+ * callbacks to the UI thread. The UI thread reads without taking any lock.
+ * The Bluetooth RX thread, the system workqueue (scan timeout) and the input
+ * thread (buttons) may all post, so posting is serialized with a spinlock to
+ * keep a single producer.
+ *
+ * Posting also wakes the UI thread, which otherwise sleeps until the next
+ * LVGL timer is due.
+ */
+
+#include <errno.h>
+#include <zephyr/kernel.h>
+#include <zephyr/sys/atomic.h>
+#include <zephyr/sys/printk.h>
+
+#include "ui_evt.h"
+
+
+#define UI_EVT_QUEUE_MASK       (UI_EVT_QUEUE_SIZE - 1)
+
+BUILD_ASSERT(IS_POWER_OF_TWO(UI_EVT_QUEUE_SIZE), "UI event queue size must be a power of two");
+
+static ui_evt_t evt_ring[UI_EVT_QUEUE_SIZE];
+static atomic_t evt_head;
+static atomic_t evt_tail;
+static atomic_t evt_dropped;
+
+static struct k_spinlock producer_lock;
+
+static K_SEM_DEFINE(evt_wake_sem, 0, 1);
+
+
+int ui_evt_post(const ui_evt_t *evt)
+{
+    k_spinlock_key_t key = k_spin_lock(&producer_lock);
+    uint32_t head = (uint32_t)atomic_get(&evt_head);
+    uint32_t tail = (uint32_t)atomic_get(&evt_tail);
+
+    if ((head - tail) >= UI_EVT_QUEUE_SIZE) {
+        k_spin_unlock(&producer_lock, key);
+        atomic_inc(&evt_dropped);
+        printk("UI event queue full, event %d dropped!\n", evt->type);
+        return -ENOMEM;
+    }
+
+    evt_ring[head & UI_EVT_QUEUE_MASK] = *evt;
+
+    /* Publish the slot only after it has been written */
+    atomic_set(&evt_head, (atomic_val_t)(head + 1));
+
+    k_spin_unlock(&producer_lock, key);
+
+    k_sem_give(&evt_wake_sem);
+
+    return 0;
+}
+
+void ui_evt_wake(void)
+{
+    k_sem_give(&evt_wake_sem);
+}
+
+bool ui_evt_wait(k_timeout_t timeout)
+{
+    return k_sem_take(&evt_wake_sem, timeout) == 0;
+}
+
+bool ui_evt_get(ui_evt_t *evt)
+{
+    uint32_t tail = (uint32_t)atomic_get(&evt_tail);
+
+    if (tail == (uint32_t)atomic_get(&evt_head)) {
+        return false;
+    }
+
+    *evt = evt_ring[tail & UI_EVT_QUEUE_MASK];
+
+    /* Release the slot only after it has been copied out */
+    atomic_set(&evt_tail, (atomic_val_t)(tail + 1));
+
+    return true;
+}
+
+uint32_t ui_evt_dropped_count(void)
+{
+    return (uint32_t)atomic_get(&evt_dropped);
+}
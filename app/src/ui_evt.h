@@ -0,0 +1,60 @@
+/*
+ * Copyright (c) 2024 Demant A/S
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+/* Header for the Bluetooth to UI event queue */
+
+#ifndef __UI_EVT_H
+#define __UI_EVT_H
+
+#include <zephyr/kernel.h>
+
+#include "ble.h"
+
+#define UI_EVT_QUEUE_SIZE       CONFIG_UI_EVT_QUEUE_SIZE
+
+
+typedef enum
+{
+    ui_evt_scan_status,
+    ui_evt_conn_status,
+    ui_evt_vcp_status,
+    ui_evt_vol_step,
+} ui_evt_type_t;
+
+typedef struct
+{
+    ui_evt_type_t type;
+    union {
+        struct {
+            scan_status_t status;
+            char dev_name[MAX_DEVICE_NAME_LEN];
+        } scan;
+        struct {
+            uint8_t conn_idx;
+            conn_status_t status;
+        } conn;
+        struct {
+            vcp_type_t type;
+            union {
+                vcp_discover_t discover;
+                vcp_vol_state_t vol_state;
+                vcp_vocs_state_t vocs_state;
+                vcp_aics_state_t aics_state;
+            };
+        } vcp;
+        struct {
+            int8_t steps;
+        } step;
+    };
+} ui_evt_t;
+
+
+int ui_evt_post(const ui_evt_t *evt);
+bool ui_evt_get(ui_evt_t *evt);
+void ui_evt_wake(void);
+bool ui_evt_wait(k_timeout_t timeout);
+uint32_t ui_evt_dropped_count(void);
+
+#endif /* __UI_EVT_H */